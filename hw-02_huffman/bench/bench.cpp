@@ -0,0 +1,415 @@
+#include "bit_writer.hpp"
+#include "code_cache.hpp"
+#include "histogram.hpp"
+#include "huffman.hpp"
+#include "huffman_codec.hpp"
+#include "huffman_decoder.hpp"
+#include "huffman_encoder.hpp"
+#include "huffman_exception.hpp"
+#include "tokenizer.hpp"
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace huffman;
+
+namespace {
+
+const size_t GENERATED_SIZE = 8 << 20;
+const int RUNS = 5;
+
+// Log-like text: a small vocabulary with skewed frequencies
+std::string generate_input() {
+    const std::vector<std::string> words = {
+        "INFO ", "WARN ", "ERROR ", "GET ", "POST ", "/api/v1/users ", "200 ", "404 ", "request ",
+        "completed ", "in ", "ms\n", "user_id=", "session ", "timeout ", "[2024-01-01T12:00:00] "
+    };
+    std::mt19937 rng(42);
+    std::geometric_distribution<size_t> pick(0.25);
+
+    std::string result;
+    result.reserve(GENERATED_SIZE + 64);
+    while (result.size() < GENERATED_SIZE) {
+        result += words[pick(rng) % words.size()];
+        result += std::to_string(rng() % 1000);
+    }
+    return result;
+}
+
+std::string load_input(int argc, char** argv) {
+    if (argc < 2)
+        return generate_input();
+
+    std::ifstream file(argv[1], std::ios::binary);
+    if (!file)
+        throw HuffmanException("Failed to open input stream");
+    return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+// Best of several runs in MB/s of `bytes` processed by `run`
+template<typename F>
+double measure(size_t bytes, F&& run) {
+    double best = 0;
+    for (int i = 0; i < RUNS; ++i) {
+        const auto start = std::chrono::steady_clock::now();
+        run();
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        best = std::max(best, bytes / elapsed.count() / 1e6);
+    }
+    return best;
+}
+
+void report(const std::string& name, double mbps) {
+    std::cout << std::left << std::setw(28) << name << std::right << std::fixed << std::setprecision(1)
+              << std::setw(10) << mbps << " MB/s" << std::endl;
+}
+
+Histogram count_symbols(const std::string& input) {
+    return count_bytes(reinterpret_cast<const uint8_t*>(input.data()), input.size());
+}
+
+std::vector<uint8_t> encode(const CodeTable& codes, const std::string& input) {
+    std::vector<uint8_t> data;
+    uint64_t buffer = 0;
+    size_t buffered = 0;
+    for (const char c : input) {
+        const CodeWord& code = codes[static_cast<uint8_t>(c)];
+        for (size_t i = code.length; i-- > 0;) {
+            buffer = (buffer << 1) | ((code.bits >> i) & 1);
+            if (++buffered == 8) {
+                data.push_back(static_cast<uint8_t>(buffer));
+                buffer = buffered = 0;
+            }
+        }
+    }
+    if (buffered != 0)
+        data.push_back(static_cast<uint8_t>(buffer << (8 - buffered)));
+    data.resize(data.size() + DECODER_PADDING, 0);
+    return data;
+}
+
+// Encodes `input` split into `ways` interleaved streams decoded into `output`
+std::vector<DecodeStream> split_streams(const CodeTable& codes, const std::string& input, size_t ways,
+                                        std::vector<std::vector<uint8_t>>& parts, std::vector<uint8_t>& output) {
+    const size_t length = (input.size() + ways - 1) / ways;
+    parts.clear();
+    for (size_t i = 0; i < ways; ++i)
+        parts.push_back(encode(codes, input.substr(std::min(i * length, input.size()), length)));
+
+    std::vector<DecodeStream> streams;
+    for (size_t i = 0; i < parts.size(); ++i) {
+        const size_t begin = std::min(i * length, input.size());
+        streams.push_back(DecodeStream{parts[i].data(), parts[i].size() - DECODER_PADDING,
+                                       output.data() + begin, std::min(length, input.size() - begin)});
+    }
+    return streams;
+}
+
+void bench_decoders(const std::string& input) {
+    HuffmanTree tree(count_symbols(input), CodeAssignment::Canonical);
+    const CodeTable codes = make_code_table(tree.get_codes());
+    const std::vector<uint8_t> data = encode(codes, input);
+    const size_t size = data.size() - DECODER_PADDING;
+
+    const std::vector<std::pair<std::string, DecoderType>> decoders = {
+        {"decode table", DecoderType::Table},
+        {"decode canonical", DecoderType::Canonical},
+        {"decode multi-symbol", DecoderType::MultiSymbol},
+        {"decode two-level", DecoderType::TwoLevel},
+        {"decode tree", DecoderType::Tree},
+        {"decode state machine", DecoderType::StateMachine},
+        {"decode gather", DecoderType::Gather},
+    };
+
+    std::vector<uint8_t> output(input.size());
+    std::vector<std::vector<uint8_t>> parts4, parts8;
+    const std::vector<DecodeStream> streams4 = split_streams(codes, input, INTERLEAVE_WAYS, parts4, output);
+    const std::vector<DecodeStream> streams8 = split_streams(codes, input, GatherDecoder::WAYS, parts8, output);
+
+    for (auto& pair : decoders) {
+        std::unique_ptr<IDecoder> decoder;
+        try {
+            decoder = make_decoder(pair.second, codes);
+        } catch (HuffmanException& exc) {
+            std::cout << pair.first << ": " << exc.what() << std::endl;
+            continue;
+        }
+
+        report(pair.first, measure(input.size(), [&]() {
+            decoder->decode(data.data(), size, output.data(), output.size());
+        }));
+        if (std::memcmp(output.data(), input.data(), input.size()) != 0)
+            throw HuffmanException(pair.first + " produced wrong output");
+
+        for (const std::vector<DecodeStream>* streams : {&streams4, &streams8}) {
+            std::fill(output.begin(), output.end(), 0);
+            report(pair.first + " x" + std::to_string(streams->size()), measure(input.size(), [&]() {
+                decoder->decode_streams(*streams);
+            }));
+            if (std::memcmp(output.data(), input.data(), input.size()) != 0)
+                throw HuffmanException(pair.first + " produced wrong output");
+        }
+    }
+}
+
+void bench_histograms(const std::string& input) {
+    std::map<uint8_t, size_t> freq_map;
+    report("histogram std::map", measure(input.size(), [&]() {
+        freq_map.clear();
+        for (const char c : input)
+            freq_map[static_cast<uint8_t>(c)]++;
+    }));
+
+    Histogram histogram{};
+    report("histogram 4 tables", measure(input.size(), [&]() {
+        histogram = count_symbols(input);
+    }));
+    for (size_t value = 0; value < histogram.size(); ++value) {
+        const auto it = freq_map.find(static_cast<uint8_t>(value));
+        if (histogram[value] != (it == freq_map.end() ? 0 : it->second))
+            throw HuffmanException("Histogram kernel produced wrong counts");
+    }
+
+    const uint8_t* data = reinterpret_cast<const uint8_t*>(input.data());
+    const size_t threads = std::max(2u, std::thread::hardware_concurrency());
+    for (size_t count = 2; count <= threads; count *= 2) {
+        Histogram parallel{};
+        report("histogram x" + std::to_string(count) + " threads", measure(input.size(), [&]() {
+            parallel = count_bytes_parallel(data, input.size(), count);
+        }));
+        if (parallel != histogram)
+            throw HuffmanException("Parallel histogram produced wrong counts");
+    }
+
+    const double exact_bits = HuffmanTree(histogram).get_compressed_bits();
+    for (SamplingMode mode : {SamplingMode::Strided, SamplingMode::Random}) {
+        SamplingOptions options;
+        options.mode = mode;
+        Histogram sampled{};
+        report(mode == SamplingMode::Strided ? "histogram strided 1/16" : "histogram random 1/16",
+               measure(input.size(), [&]() {
+            sampled = sample_bytes(data, input.size(), options);
+        }));
+
+        // Bits the sampled codes take on the real counts
+        const CodeLengths lengths = HuffmanTree(sampled).get_code_lengths();
+        double bits = 0;
+        for (size_t value = 0; value < histogram.size(); ++value)
+            bits += static_cast<double>(histogram[value]) * lengths[value];
+        const double cost = exact_bits == 0 ? 0 : 100.0 * (bits - exact_bits) / exact_bits;
+        std::cout << "  ratio cost: " << std::setprecision(3) << cost << " %" << std::endl;
+    }
+}
+
+// Many small blocks, each with its own codes, where building the tables takes most of the time
+void bench_code_building(const std::string& input) {
+    const size_t block_size = 4096;
+    std::vector<Histogram> histograms;
+    for (size_t begin = 0; begin + block_size <= input.size(); begin += block_size)
+        histograms.push_back(count_bytes(reinterpret_cast<const uint8_t*>(input.data()) + begin, block_size));
+    const size_t bytes = histograms.size() * block_size;
+
+    for (CodeAssignment assignment : {CodeAssignment::TreeShape, CodeAssignment::Canonical}) {
+        uint64_t bits = 0;
+        report(assignment == CodeAssignment::TreeShape ? "build 4K tree-shaped" : "build 4K canonical",
+               measure(bytes, [&]() {
+            bits = 0;
+            for (const Histogram& histogram : histograms)
+                bits += HuffmanTree(histogram, assignment).get_compressed_bits();
+        }));
+        if (bits == 0 && bytes != 0)
+            throw HuffmanException("Code building produced empty codes");
+    }
+}
+
+// Blocks of one log format often get the same length-limited codes, the cache builds their tables once
+void bench_table_cache(const std::string& input) {
+    const size_t block_size = 64 << 10;
+    std::vector<CodeTable> tables;
+    for (size_t begin = 0; begin + block_size <= input.size(); begin += block_size) {
+        const Histogram histogram = count_bytes(reinterpret_cast<const uint8_t*>(input.data()) + begin, block_size);
+        tables.push_back(HuffmanTree(histogram, CodeAssignment::Canonical, 11).get_code_table());
+    }
+    const size_t bytes = tables.size() * block_size;
+
+    CodeCache cache;
+    for (bool cached : {false, true}) {
+        report(cached ? "tables 64K cached" : "tables 64K uncached", measure(bytes, [&]() {
+            cache.clear();
+            for (const CodeTable& codes : tables) {
+                if (cached) {
+                    cache.encoder(codes, EncoderType::Pair, block_size);
+                    cache.decoder(codes, DecoderType::Auto);
+                } else {
+                    make_encoder(EncoderType::Pair, codes, block_size);
+                    make_decoder(DecoderType::Auto, codes);
+                }
+            }
+        }));
+    }
+    const CodeCacheStats stats = cache.stats();
+    std::cout << "  cache hits: " << stats.hits << ", misses: " << stats.misses << std::endl;
+}
+
+void bench_encoders(const std::string& input) {
+    HuffmanTree tree(count_symbols(input));
+    const CodeTable& codes = tree.get_code_table();
+    const std::vector<uint8_t> expected = encode(codes, input);
+
+    report("encode bit loop", measure(input.size(), [&]() {
+        encode(codes, input);
+    }));
+
+    const std::vector<std::pair<std::string, EncoderType>> encoders = {
+        {"encode symbol", EncoderType::Symbol},
+        {"encode pair table", EncoderType::Pair},
+        {"encode batch", EncoderType::Batch},
+    };
+
+    std::ostringstream sink;
+    for (auto& pair : encoders) {
+        std::unique_ptr<IEncoder> encoder = make_encoder(pair.second, codes, input.size());
+        report(pair.first, measure(input.size(), [&]() {
+            sink.str(std::string());
+            BitWriter writer(sink);
+            encoder->encode(input, writer);
+            writer.finish();
+        }));
+        if (sink.str() != std::string(expected.begin(), expected.end() - DECODER_PADDING))
+            throw HuffmanException(pair.first + " produced wrong output");
+    }
+
+    const size_t size = expected.size() - DECODER_PADDING;
+    std::vector<uint8_t> output(size + BIT_WRITER_PADDING);
+    std::unique_ptr<IEncoder> encoder = make_encoder(EncoderType::Auto, codes, input.size());
+    const size_t threads = std::max(2u, std::thread::hardware_concurrency());
+    for (size_t count = 2; count <= threads; count *= 2) {
+        report("encode x" + std::to_string(count) + " threads", measure(input.size(), [&]() {
+            encode_parallel(*encoder, tree.get_code_lengths(), input, output.data(), size, count);
+        }));
+        if (!std::equal(output.begin(), output.begin() + size, expected.begin()))
+            throw HuffmanException("Parallel encoding produced wrong output");
+    }
+}
+
+// Ratio cost of length-limited codes and decoding speed with them
+template<typename Codec, typename Symbol>
+void bench_codec(const std::string& name, const std::vector<Symbol>& data, size_t bytes) {
+    const Codec codec(Codec::count(data.data(), data.size()));
+    std::vector<uint8_t> encoded(codec.encoded_size(data.data(), data.size()) + Codec::PADDING);
+    size_t size = 0;
+    report(name + " encode", measure(bytes, [&]() {
+        size = codec.encode(data.data(), data.size(), encoded.data());
+    }));
+
+    std::vector<Symbol> decoded(data.size());
+    report(name + " decode", measure(bytes, [&]() {
+        codec.decode(encoded.data(), size, decoded.data(), decoded.size());
+    }));
+    if (decoded != data)
+        throw HuffmanException("Codec produced wrong output");
+}
+
+void bench_codecs(const std::string& input) {
+    const std::vector<uint8_t> bytes(input.begin(), input.end());
+    bench_codec<HuffmanCodec<uint8_t, 11, uint64_t>>("codec u8/11 x64", bytes, input.size());
+    bench_codec<HuffmanCodec<uint8_t, 11, uint32_t>>("codec u8/11 x32", bytes, input.size());
+
+    // Byte pairs as 16-bit symbols
+    std::vector<uint16_t> pairs(input.size() / 2);
+    std::memcpy(pairs.data(), input.data(), pairs.size() * sizeof(uint16_t));
+    bench_codec<HuffmanCodec<uint16_t, 16, uint64_t>>("codec u16/16 x64", pairs, pairs.size() * sizeof(uint16_t));
+    // What the 16-bit archive format uses: long codes and a small primary table
+    bench_codec<HuffmanCodec<uint16_t, 20, uint64_t, 12>>("codec u16/20 t12", pairs, pairs.size() * sizeof(uint16_t));
+}
+
+void bench_tokens(const std::string& input) {
+    Tokenization tokens;
+    report("tokenize", measure(input.size(), [&]() {
+        tokens = tokenize(input);
+    }));
+
+    using TokenCodec = HuffmanCodec<uint16_t, 20, uint64_t, 12>;
+    const TokenCodec codec(TokenCodec::count(tokens.ids.data(), tokens.ids.size()));
+    std::vector<uint8_t> encoded = codec.encode(tokens.ids.data(), tokens.ids.size());
+    const size_t size = encoded.size();
+    encoded.resize(size + TokenCodec::PADDING);
+
+    const TokenTable table(tokens.words);
+    std::vector<uint16_t> ids(tokens.ids.size());
+    std::vector<uint8_t> output(input.size() + TOKEN_PADDING);
+    report("decode tokens", measure(input.size(), [&]() {
+        codec.decode(encoded.data(), size, ids.data(), ids.size());
+        table.expand(ids.data(), ids.size(), output.data(), input.size());
+    }));
+    if (std::memcmp(output.data(), input.data(), input.size()) != 0)
+        throw HuffmanException("Token decoding produced wrong output");
+
+    size_t dictionary = 0;
+    for (const std::string_view word : tokens.words)
+        dictionary += word.size() + 1;
+    const double bits = HuffmanTree(count_symbols(input)).get_compressed_bits();
+    std::cout << "  tokens: " << tokens.ids.size() << ", words: " << tokens.words.size()
+              << ", size vs bytes: " << std::setprecision(3) << 100.0 * (size + dictionary) / (bits / 8)
+              << " %" << std::endl;
+}
+
+void bench_length_limits(const std::string& input) {
+    const Histogram histogram = count_symbols(input);
+    std::vector<uint8_t> output(input.size());
+
+    for (size_t limit : {11, 12, 15}) {
+        HuffmanTree tree(histogram, CodeAssignment::Canonical, limit);
+        const CodeTable codes = make_code_table(tree.get_codes());
+        const std::vector<uint8_t> data = encode(codes, input);
+
+        std::unique_ptr<IDecoder> decoder = make_decoder(DecoderType::Auto, codes);
+        report("decode limit " + std::to_string(limit), measure(input.size(), [&]() {
+            decoder->decode(data.data(), data.size() - DECODER_PADDING, output.data(), output.size());
+        }));
+        if (std::memcmp(output.data(), input.data(), input.size()) != 0)
+            throw HuffmanException("Length-limited codes produced wrong output");
+
+        const double cost = tree.get_unlimited_compressed_bits() == 0 ? 0 :
+            100.0 * (tree.get_compressed_bits() - tree.get_unlimited_compressed_bits()) /
+            tree.get_unlimited_compressed_bits();
+        std::cout << "  ratio cost: " << std::setprecision(3) << cost << " %" << std::endl;
+    }
+}
+
+} // anonymous namespace
+
+int main(int argc, char** argv) {
+    try {
+        const std::string input = load_input(argc, argv);
+        std::cout << "input: " << input.size() << " bytes" << std::endl;
+
+        bench_histograms(input);
+        bench_code_building(input);
+        bench_table_cache(input);
+        bench_encoders(input);
+        bench_decoders(input);
+        bench_codecs(input);
+        bench_tokens(input);
+        bench_length_limits(input);
+
+    } catch (HuffmanException& exc) {
+
+        std::cout << exc.what() << std::endl;
+
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,88 @@
+#ifndef BIT_READER_H_
+#define BIT_READER_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace huffman {
+
+// Readable bytes that must follow the data given to BitReader
+const size_t BIT_READER_PADDING = 8;
+
+// Bits the container holds after a refill
+const size_t BIT_READER_MIN_AVAILABLE = 57;
+
+inline uint64_t load_big_endian64(const uint8_t* data) {
+    uint64_t word;
+    std::memcpy(&word, data, sizeof(word));
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    word = __builtin_bswap64(word);
+#endif
+    return word;
+}
+
+// MSB-first reader keeping the next bits of the stream in a 64-bit container, the first one in the top bit.
+// A refill is one unaligned 8-byte load. Reads past the end are clamped to the guard padding instead of
+// being checked bit by bit, so after decoding the caller checks overrun() once.
+class BitReader {
+public:
+    BitReader(const uint8_t* data, size_t size) : data_(data), size_(size), position_(0), bits_(0), available_(0) {
+        refill();
+    }
+
+    // Makes at least BIT_READER_MIN_AVAILABLE bits available
+    void refill() {
+        const size_t byte = std::min(position_ >> 3, size_);
+        bits_ = load_big_endian64(data_ + byte) << (position_ & 7);
+        available_ = 64 - (position_ & 7);
+    }
+
+    size_t available() const {
+        return available_;
+    }
+
+    // Next bits without consuming them: the whole container or the top `count` bits (1 to 57)
+    uint64_t peek() const {
+        return bits_;
+    }
+
+    uint64_t peek(size_t count) const {
+        return bits_ >> (64 - count);
+    }
+
+    void consume(size_t count) {
+        bits_ <<= count;
+        available_ -= count;
+        position_ += count;
+    }
+
+    uint64_t read(size_t count) {
+        if (available_ < count)
+            refill();
+        const uint64_t result = peek(count);
+        consume(count);
+        return result;
+    }
+
+    size_t position() const {
+        return position_;
+    }
+
+    // More bits consumed than the data has
+    bool overrun() const {
+        return position_ > size_ * 8;
+    }
+
+private:
+    const uint8_t* data_;
+    size_t size_;
+    size_t position_;
+    uint64_t bits_;
+    size_t available_;
+};
+
+} // namespace huffman
+
+#endif  // BIT_READER_H_
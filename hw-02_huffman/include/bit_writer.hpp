@@ -0,0 +1,138 @@
+#ifndef BIT_WRITER_H_
+#define BIT_WRITER_H_
+
+#include "huffman_exception.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <vector>
+
+namespace huffman {
+
+// Bytes collected before a write to the sink
+const size_t BIT_WRITER_BUFFER_SIZE = size_t(1) << 20;
+
+// Writable bytes that must follow the memory given to BitWriter
+const size_t BIT_WRITER_PADDING = sizeof(uint32_t);
+
+// Longest code write() takes at once
+const size_t BIT_WRITER_MAX_BITS = 56;
+
+inline void store_big_endian32(uint8_t* data, uint32_t word) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    word = __builtin_bswap32(word);
+#endif
+    std::memcpy(data, &word, sizeof(word));
+}
+
+inline void store_big_endian64(uint8_t* data, uint64_t word) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    word = __builtin_bswap64(word);
+#endif
+    std::memcpy(data, &word, sizeof(word));
+}
+
+// MSB-first writer packing codes into a 64-bit container, the first bit in the top one.
+// Full 32-bit words go either to a buffer that is written to the sink in BIT_WRITER_BUFFER_SIZE pieces
+// or straight to memory the caller has sized in advance, the bytes are the same as with bit-by-bit packing.
+class BitWriter {
+public:
+    explicit BitWriter(std::ostream& sink, size_t buffer_size = BIT_WRITER_BUFFER_SIZE)
+        : sink_(&sink), own_(buffer_size + BIT_WRITER_PADDING), data_(own_.data()), capacity_(buffer_size),
+          position_(0), bits_(0), filled_(0), written_(0) {}
+
+    // Writes exactly `size` bytes to `data`, which must be followed by BIT_WRITER_PADDING writable bytes
+    BitWriter(uint8_t* data, size_t size)
+        : sink_(nullptr), data_(data), capacity_(size), position_(0), bits_(0), filled_(0), written_(0) {}
+
+    // Appends the low `count` bits of `bits` (1 to BIT_WRITER_MAX_BITS), the rest of them must be zero
+    void write(uint64_t bits, size_t count) {
+        if (count > 32) {
+            put(bits >> 32, count - 32);
+            bits &= 0xFFFFFFFF;
+            count = 32;
+        }
+        put(bits, count);
+    }
+
+    // Appends whole bytes, copying them straight into the buffer when no odd bits are pending
+    void write_bytes(const uint8_t* data, size_t size) {
+        if (filled_ % 8 != 0) {
+            for (size_t i = 0; i < size; ++i)
+                put(data[i], 8);
+            return;
+        }
+
+        for (; filled_ > 0; filled_ -= 8) {
+            data_[position_++] = static_cast<uint8_t>(bits_ >> 56);
+            bits_ <<= 8;
+        }
+        for (;;) {
+            if (position_ > capacity_ || (position_ == capacity_ && size != 0))
+                flush();
+            if (size == 0)
+                break;
+            const size_t chunk = std::min(size, capacity_ - position_);
+            std::memcpy(data_ + position_, data, chunk);
+            position_ += chunk;
+            data += chunk;
+            size -= chunk;
+        }
+    }
+
+    // Pads the last byte with zeros and writes everything out, returns bytes written in total
+    size_t finish() {
+        for (; filled_ > 0; filled_ -= std::min<size_t>(filled_, 8)) {
+            data_[position_++] = static_cast<uint8_t>(bits_ >> 56);
+            bits_ <<= 8;
+        }
+        if (sink_ || position_ > capacity_)
+            flush();
+        return written_ + position_;
+    }
+
+private:
+    // Keeps less than 32 bits in the container between calls, so `count` up to 32 always fits
+    void put(uint64_t bits, size_t count) {
+        bits_ |= bits << (64 - filled_ - count);
+        filled_ += count;
+        if (filled_ < 32)
+            return;
+
+        // There is always room for a word up to the end of the padding
+        store_big_endian32(data_ + position_, static_cast<uint32_t>(bits_ >> 32));
+        position_ += sizeof(uint32_t);
+        bits_ <<= 32;
+        filled_ -= 32;
+        if (position_ > capacity_)
+            flush();
+    }
+
+    void flush() {
+        if (!sink_)
+            throw HuffmanException("Compressed data is bigger than expected");
+
+        sink_->write(reinterpret_cast<const char*>(data_), static_cast<std::streamsize>(position_));
+        if (!*sink_)
+            throw HuffmanException("Failed to write in file");
+        written_ += position_;
+        position_ = 0;
+    }
+
+private:
+    std::ostream* sink_;
+    std::vector<uint8_t> own_;
+    uint8_t* data_;
+    // Bytes written to `data_` between flushes, the padding after them only takes overflowing words
+    size_t capacity_;
+    size_t position_;
+    uint64_t bits_;
+    size_t filled_;
+    size_t written_;
+};
+
+} // namespace huffman
+
+#endif  // BIT_WRITER_H_
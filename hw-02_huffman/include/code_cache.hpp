@@ -0,0 +1,70 @@
+#ifndef CODE_CACHE_H_
+#define CODE_CACHE_H_
+
+#include "huffman.hpp"
+#include "huffman_decoder.hpp"
+#include "huffman_encoder.hpp"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+namespace huffman {
+
+// Code sets the process-wide cache keeps before dropping the least recently used one
+const size_t CODE_CACHE_CAPACITY = 16;
+
+struct CodeCacheStats {
+    // Tables returned ready-made and tables built on request
+    uint64_t hits;
+    uint64_t misses;
+    // Code sets held now
+    size_t size;
+};
+
+// LRU cache of encoders and decoders keyed by a hash of the code table they are built from, so
+// inputs with the same statistics reuse the tables instead of building them again. Every code set
+// holds its tables of every type, built on the first request. Thread-safe.
+class CodeCache {
+public:
+    explicit CodeCache(size_t capacity = CODE_CACHE_CAPACITY);
+
+    // The cache HuffmanArchive uses
+    static CodeCache& global();
+
+    // Auto is resolved by the data size before the lookup, like in make_encoder()
+    std::shared_ptr<const IEncoder> encoder(const CodeTable& codes, EncoderType type, size_t data_size);
+    std::shared_ptr<const IDecoder> decoder(const CodeTable& codes, DecoderType type);
+
+    CodeCacheStats stats() const;
+    // Drops every code set and resets the counters
+    void clear();
+
+private:
+    struct Entry {
+        CodeTable codes;
+        // One slot per EncoderType and DecoderType
+        std::array<std::shared_ptr<const IEncoder>, 4> encoders;
+        std::array<std::shared_ptr<const IDecoder>, 8> decoders;
+    };
+    using Entries = std::list<Entry>;
+
+    // Finds the code set or adds it, making it the most recently used one
+    Entry& lookup(const CodeTable& codes);
+
+private:
+    size_t capacity_;
+    mutable std::mutex mutex_;
+    // Most recently used first
+    Entries entries_;
+    std::unordered_multimap<uint64_t, Entries::iterator> index_;
+    uint64_t hits_;
+    uint64_t misses_;
+};
+
+} // namespace huffman
+
+#endif  // CODE_CACHE_H_
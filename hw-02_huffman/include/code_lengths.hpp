@@ -0,0 +1,137 @@
+#ifndef CODE_LENGTHS_H_
+#define CODE_LENGTHS_H_
+
+#include "huffman.hpp"
+#include "huffman_exception.hpp"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace huffman {
+
+// Present symbols sorted by count (ties by symbol value) with an LSD radix sort over the count bytes,
+// passes where every count has the same byte are skipped. Returns how many symbols are present.
+constexpr size_t sort_by_count(const Histogram& histogram, std::array<uint16_t, 256>& order) {
+    size_t n = 0;
+    for (size_t symbol = 0; symbol < histogram.size(); ++symbol) {
+        if (histogram[symbol] != 0)
+            order[n++] = static_cast<uint16_t>(symbol);
+    }
+
+    std::array<uint16_t, 256> sorted{};
+    for (size_t shift = 0; shift < 64 && n > 1; shift += 8) {
+        std::array<size_t, 256> offsets{};
+        for (size_t i = 0; i < n; ++i)
+            offsets[(histogram[order[i]] >> shift) & 0xFF]++;
+        if (offsets[(histogram[order[0]] >> shift) & 0xFF] == n)
+            continue;
+
+        size_t offset = 0;
+        for (size_t& count : offsets) {
+            const size_t next = offset + count;
+            count = offset;
+            offset = next;
+        }
+        for (size_t i = 0; i < n; ++i)
+            sorted[offsets[(histogram[order[i]] >> shift) & 0xFF]++] = order[i];
+        order = sorted;
+    }
+    return n;
+}
+
+// Huffman code lengths of the present symbols, computed in place over the sorted counts
+// (Moffat and Katajainen): the same array holds the weights, then parent indices, then depths.
+// No tree is built and nothing is allocated, so it also runs at compile time.
+constexpr CodeLengths huffman_code_lengths(const Histogram& histogram) {
+    std::array<uint16_t, 256> order{};
+    const size_t n = sort_by_count(histogram, order);
+
+    CodeLengths lengths{};
+    if (n == 1)
+        lengths[order[0]] = 1;
+    if (n <= 1)
+        return lengths;
+
+    std::array<uint64_t, 256> a{};
+    for (size_t i = 0; i < n; ++i)
+        a[i] = histogram[order[i]];
+
+    // Internal nodes take the places of the leaves already merged, a node keeps its parent's index
+    a[0] += a[1];
+    size_t root = 0;
+    size_t leaf = 2;
+    for (size_t next = 1; next < n - 1; ++next) {
+        if (leaf >= n || a[root] < a[leaf]) {
+            a[next] = a[root];
+            a[root++] = next;
+        } else {
+            a[next] = a[leaf++];
+        }
+
+        if (leaf >= n || (root < next && a[root] < a[leaf])) {
+            a[next] += a[root];
+            a[root++] = next;
+        } else {
+            a[next] += a[leaf++];
+        }
+    }
+
+    // Depths of the internal nodes from the root down
+    a[n - 2] = 0;
+    for (size_t next = n - 2; next-- > 0;)
+        a[next] = a[a[next]] + 1;
+
+    // Leaves hang off the free slots of every level, the lightest ones end up deepest
+    size_t available = 1;
+    size_t depth = 0;
+    size_t internal = n - 1;
+    size_t next = n;
+    while (available > 0) {
+        size_t used = 0;
+        while (internal > 0 && a[internal - 1] == depth) {
+            ++used;
+            --internal;
+        }
+        for (; available > used; --available)
+            a[--next] = depth;
+        available = 2 * used;
+        ++depth;
+    }
+
+    for (size_t i = 0; i < n; ++i)
+        lengths[order[i]] = static_cast<uint8_t>(a[i]);
+    return lengths;
+}
+
+// Canonical codes for the lengths: consecutive codes for symbols sorted by length and then by value
+constexpr CodeTable canonical_code_table(const CodeLengths& lengths) {
+    std::array<size_t, MAX_CODE_LENGTH + 1> length_count{};
+    for (const uint8_t length : lengths) {
+        if (length > MAX_CODE_LENGTH)
+            throw HuffmanException("Code length must be from 1 to " + std::to_string(MAX_CODE_LENGTH));
+        length_count[length]++;
+    }
+    length_count[0] = 0;
+
+    // First code of every length, a longer code continues right after the shorter ones
+    std::array<uint64_t, MAX_CODE_LENGTH + 1> next_code{};
+    uint64_t code = 0;
+    for (size_t length = 1; length <= MAX_CODE_LENGTH; ++length) {
+        code = (code + length_count[length - 1]) << 1;
+        next_code[length] = code;
+        if (length_count[length] > (uint64_t(1) << length) - code)
+            throw HuffmanException("Code lengths don't form a prefix code");
+    }
+
+    CodeTable table{};
+    for (size_t symbol = 0; symbol < lengths.size(); ++symbol) {
+        const uint8_t length = lengths[symbol];
+        if (length != 0)
+            table[symbol] = CodeWord{next_code[length]++, length};
+    }
+    return table;
+}
+
+} // namespace huffman
+
+#endif  // CODE_LENGTHS_H_
@@ -0,0 +1,48 @@
+#ifndef HISTOGRAM_H_
+#define HISTOGRAM_H_
+
+#include "huffman.hpp"
+#include <cstddef>
+#include <cstdint>
+
+namespace huffman {
+
+// Counter tables the histogram kernel spreads consecutive bytes over
+const size_t HISTOGRAM_TABLES = 4;
+
+// Counts every byte value of `data`. Consecutive bytes go to different counter tables, so runs
+// of one value don't wait for the previous increment of the same counter to reach memory.
+Histogram count_bytes(const uint8_t* data, size_t size);
+
+// Smallest piece of the input worth a thread of its own
+const size_t HISTOGRAM_MIN_CHUNK = size_t(4) << 20;
+
+// count_bytes() over disjoint chunks with up to `threads` threads, each into its own histogram,
+// summed at the end. The result is the same for any number of threads.
+Histogram count_bytes_parallel(const uint8_t* data, size_t size, size_t threads);
+
+enum class SamplingMode : uint8_t {
+    None = 0,     // every byte is counted
+    Strided = 1,  // the first block of every `stride` blocks
+    Random = 2,   // one block at a random place in every `stride` blocks
+};
+
+struct SamplingOptions {
+    SamplingMode mode = SamplingMode::None;
+    // Bytes counted together, whole blocks are either sampled or skipped
+    size_t block_size = size_t(64) << 10;
+    // One block of this many is counted
+    size_t stride = 16;
+    // Random mode picks the same blocks for the same seed
+    uint64_t seed = 1;
+    // Also count the whole input to report how much the sampled codes lose
+    bool measure_loss = true;
+};
+
+// Estimates the histogram of `data` from sampled blocks scaled up to `size` bytes. Every byte value
+// gets a count of at least one, so the codes built from it can encode bytes the samples missed.
+Histogram sample_bytes(const uint8_t* data, size_t size, const SamplingOptions& options);
+
+} // namespace huffman
+
+#endif  // HISTOGRAM_H_
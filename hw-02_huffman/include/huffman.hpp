@@ -1,7 +1,9 @@
 #ifndef HUFFMAN_H_
 #define HUFFMAN_H_
 
+#include <array>
 #include <cstddef>
+#include <cstdint>
 #include <memory>
 #include <vector>
 #include <map>
@@ -14,31 +16,77 @@
 
 namespace huffman {
 
+// Longest code the bit-window decoders can peek in one go.
+const size_t MAX_CODE_LENGTH = 56;
+
+// Code bits are right-aligned and written MSB first, length 0 marks an absent symbol.
+struct CodeWord {
+    uint64_t bits;
+    uint8_t length;
+};
+
+using CodeTable = std::array<CodeWord, 256>;
+using CodeLengths = std::array<uint8_t, 256>;
+// Count of every byte value
+using Histogram = std::array<uint64_t, 256>;
+
+CodeWord make_code_word(const std::string& code);
+std::string code_to_string(const CodeWord& code);
+CodeTable make_code_table(const std::map<uint8_t, std::string>& codes);
+// Assigns consecutive codes to symbols sorted by code length and then by symbol value.
+CodeTable make_canonical_codes(const CodeLengths& lengths);
+bool is_canonical(const CodeTable& codes);
+
+// Optimal code lengths not longer than `max_length` for the given frequencies (package-merge)
+std::vector<uint8_t> limited_code_lengths(const std::vector<uint64_t>& freqs, size_t max_length);
+// Throws if some code is a prefix of another one, so the table can't be decoded unambiguously.
+void check_prefix_free(const CodeTable& codes);
+
+enum class CodeAssignment {
+    TreeShape,  // codes follow the tree branches
+    Canonical,  // codes are restored from lengths alone
+};
+
 class HuffmanTree {
 private:
+    // Leaves come first in the node array, then parents in the order of merges
     struct Node {
+        uint64_t freq;
+        uint16_t left;
+        uint16_t right;
         uint8_t data;
-        size_t freq;
-        Node* left;
-        Node* right;
-
-        Node(uint8_t data, size_t freq) : data(data), freq(freq), left(nullptr), right(nullptr) {}
     };
 
 public:
-    explicit HuffmanTree(const std::map<uint8_t, size_t>& freqMap);
-    ~HuffmanTree();
-    
+    // Codes longer than `max_code_length` are replaced with optimal length-limited canonical codes
+    explicit HuffmanTree(const Histogram& histogram,
+                         CodeAssignment assignment = CodeAssignment::TreeShape,
+                         size_t max_code_length = MAX_CODE_LENGTH);
+    explicit HuffmanTree(const std::map<uint8_t, size_t>& freqMap,
+                         CodeAssignment assignment = CodeAssignment::TreeShape,
+                         size_t max_code_length = MAX_CODE_LENGTH);
+
     std::map<uint8_t, std::string> get_codes() const;
+    CodeLengths get_code_lengths() const;
+    // Integer codes for the encoder, indexed by symbol
+    const CodeTable& get_code_table() const;
+
+    // Size of the encoded data with the chosen codes and with the unlimited Huffman codes
+    uint64_t get_compressed_bits() const;
+    uint64_t get_unlimited_compressed_bits() const;
 
 private:
-    void build_tree(const std::map<uint8_t, size_t>& freqMap);
-    void delete_tree(Node* node);
-    void generateCodeHelper(Node* node, const std::string& code);
+    void build_tree(const Histogram& histogram);
+    void generate_codes(const Node* nodes, size_t leaves, size_t root);
+    void assign_canonical_codes();
+    void limit_code_lengths(const Histogram& histogram, size_t max_code_length);
+    uint64_t count_compressed_bits(const Histogram& histogram) const;
     
 private:
-    Node* root_;
-    std::map<uint8_t, std::string> symbolCodes_;
+    CodeTable symbolCodes_{};
+    CodeLengths codeLengths_{};
+    uint64_t compressedBits_;
+    uint64_t unlimitedCompressedBits_;
 };
 
 }
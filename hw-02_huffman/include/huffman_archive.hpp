@@ -1,8 +1,15 @@
 #ifndef HUFFMAN_ARCHIVE_H_
 #define HUFFMAN_ARCHIVE_H_
 
+#include "bit_writer.hpp"
+#include "code_cache.hpp"
+#include "histogram.hpp"
 #include "huffman.hpp"
+#include "huffman_codec.hpp"
+#include "huffman_decoder.hpp"
+#include "huffman_encoder.hpp"
 #include "huffman_exception.hpp"
+#include "tokenizer.hpp"
 #include <cstddef>
 #include <memory>
 #include <vector>
@@ -10,6 +17,7 @@
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <string_view>
 
 namespace huffman {
 
@@ -17,11 +25,47 @@ struct ArchiveInfo {
     size_t original_size;
     size_t compressed_size;
     size_t extra_size;
+    // Compressed size with codes from the exact histogram, set when sampled codes measure their loss
+    size_t exact_compressed_size;
 
     ArchiveInfo(size_t os, size_t cs, size_t es)
-        : original_size(os), compressed_size(cs), extra_size(es) {}
+        : original_size(os), compressed_size(cs), extra_size(es), exact_compressed_size(0) {}
 };
 
+enum class ArchiveFormat : uint8_t {
+    Legacy = 0,     // code strings in meta
+    Canonical = 1,  // canonical codes, only their lengths in meta
+    Interleaved = 2,  // canonical codes, data split into independent streams with their sizes in meta
+    Wide16 = 3,     // little-endian 16-bit symbols with canonical codes, an odd last byte is kept in meta
+    Tokens = 4,     // ids of words and separators with canonical codes, the word dictionary in meta
+};
+
+// 16-bit codes are limited to this length, the decode table is indexed by their first WIDE_TABLE_BITS bits
+const size_t WIDE_MAX_CODE_LENGTH = 20;
+const size_t WIDE_TABLE_BITS = 12;
+
+// Legacy meta keeps a codes count (at most 256) right after the original size,
+// newer formats put this tag with the format number in the low byte there.
+const size_t FORMAT_TAG = 0x4655480000000000;
+
+struct ArchiveOptions {
+    ArchiveFormat format = ArchiveFormat::Legacy;
+    DecoderType decoder = DecoderType::Auto;
+    // Streams of the interleaved format
+    size_t streams = INTERLEAVE_WAYS;
+    // Longer codes are replaced with length-limited ones, costing a little ratio for smaller decode tables
+    size_t max_code_length = MAX_CODE_LENGTH;
+    EncoderType encoder = EncoderType::Auto;
+    // Threads counting the input and encoding every stream, the output doesn't depend on it
+    size_t threads = 1;
+    // Codes from sampled blocks skip counting the whole input
+    SamplingOptions sampling = SamplingOptions();
+    // Encoders and decoders come from CodeCache::global(), so inputs with the same codes share them
+    bool cache_tables = true;
+};
+
+const size_t MAX_STREAMS = 255;
+
 class IArchivatorAlgorithm {
 public:
     IArchivatorAlgorithm(std::string input, std::string output) : input_path_(input), output_path_(output) {}
@@ -37,7 +81,7 @@ protected:
 
 class HuffmanArchive : public IArchivatorAlgorithm {
 public:
-    HuffmanArchive(std::string& input, std::string& output);
+    HuffmanArchive(std::string& input, std::string& output, const ArchiveOptions& options = ArchiveOptions());
 
     virtual ArchiveInfo compress() override;
     virtual ArchiveInfo decompress() override;
@@ -52,12 +96,36 @@ private:
     size_t write_to_file(T& data);
 
     size_t write_meta(size_t bytes_count, std::map<uint8_t, std::string>& codes);
-    size_t read_meta(size_t& result_file_size, std::map<std::string, uint8_t>& symbols);
+    size_t write_lengths_meta(size_t bytes_count, const CodeLengths& lengths);
+    size_t write_stream_sizes(const std::vector<size_t>& stream_sizes);
+    size_t read_meta(size_t& result_file_size, ArchiveFormat& format, CodeTable& codes,
+                     std::vector<size_t>& stream_sizes);
+    size_t read_code_strings(size_t codes_count, CodeTable& codes);
+    size_t read_code_lengths(CodeTable& codes);
+    size_t read_stream_sizes(std::vector<size_t>& stream_sizes);
     
-    size_t write_compressed_data(std::string& buffer, std::map<uint8_t, std::string>& codes);
-    size_t read_compressed_data(size_t expected_orig_size, std::map<std::string, uint8_t>& symbols);
+    void write_compressed_data(const std::vector<std::string_view>& streams, const std::vector<size_t>& stream_sizes,
+                               size_t compressed_size, const IEncoder& encoder, const CodeLengths& lengths);
+    size_t write_streamed_data(std::string_view data, const IEncoder& encoder);
+
+    ArchiveInfo compress_wide(const std::vector<uint8_t>& input, size_t size);
+    size_t write_wide_lengths(const std::vector<uint8_t>& lengths);
+    size_t read_wide_lengths(std::vector<uint8_t>& lengths);
+    size_t read_wide_data(size_t expected_orig_size, const std::vector<uint8_t>& lengths, uint8_t last_byte);
+
+    ArchiveInfo compress_tokens(std::string_view data);
+    size_t write_token_dictionary(const std::vector<std::string_view>& words);
+    size_t read_token_dictionary(std::vector<std::string>& words);
+    size_t read_token_data(size_t expected_orig_size, const std::vector<std::string>& words, size_t tokens_count,
+                           const std::vector<uint8_t>& lengths);
+    size_t read_compressed_data(size_t expected_orig_size, const CodeTable& codes,
+                                const std::vector<size_t>& stream_sizes);
+
+    std::vector<uint8_t> read_payload();
 
 private:
+    ArchiveOptions options_;
+
     std::ifstream input_stream_;
     std::ofstream output_stream_;
 };
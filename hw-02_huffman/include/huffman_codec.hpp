@@ -0,0 +1,274 @@
+#ifndef HUFFMAN_CODEC_H_
+#define HUFFMAN_CODEC_H_
+
+#include "huffman.hpp"
+#include "huffman_exception.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <type_traits>
+#include <vector>
+
+namespace huffman {
+
+template<typename Word>
+Word load_big_endian(const uint8_t* data) {
+    Word word;
+    std::memcpy(&word, data, sizeof(word));
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    if constexpr (sizeof(Word) == 8)
+        word = __builtin_bswap64(word);
+    else
+        word = __builtin_bswap32(word);
+#endif
+    return word;
+}
+
+template<typename Word>
+void store_big_endian(uint8_t* data, Word word) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    if constexpr (sizeof(Word) == 8)
+        word = __builtin_bswap64(word);
+    else
+        word = __builtin_bswap32(word);
+#endif
+    std::memcpy(data, &word, sizeof(word));
+}
+
+// Canonical Huffman codec over symbols 0..alphabet_size()-1 of type `Symbol`, for bytes as well as
+// 16-bit samples or 32-bit token ids. Codes are at most `MaxBits` long. Codes up to `TableBits` are
+// decoded by one lookup in a table of 2^TableBits entries, longer ones by comparing the window with
+// the first canonical code of every longer length. Both loops keep the bits in a `BitBuffer`
+// (32 or 64 bits) and move whole words to and from memory; everything the loops depend on is
+// a compile-time constant. The bit stream is MSB-first, the same as BitWriter gives for the same codes.
+template<typename Symbol, size_t MaxBits = 15, typename BitBuffer = uint64_t, size_t TableBits = MaxBits>
+class HuffmanCodec {
+public:
+    static_assert(std::is_unsigned<Symbol>::value && sizeof(Symbol) <= sizeof(uint32_t),
+                  "Symbols must be unsigned integers up to 32 bits");
+    static_assert(std::is_same<BitBuffer, uint32_t>::value || std::is_same<BitBuffer, uint64_t>::value,
+                  "The bit buffer must be uint32_t or uint64_t");
+
+    static constexpr size_t BUFFER_BITS = std::numeric_limits<BitBuffer>::digits;
+    static constexpr size_t MAX_BITS = MaxBits;
+    static constexpr size_t TABLE_BITS = TableBits;
+    // Bytes that must follow the input of decode() and the output of encode()
+    static constexpr size_t PADDING = sizeof(BitBuffer);
+
+    // Whole bytes are flushed before a code that may not fit, so at least one bit of the buffer stays free
+    static_assert(MaxBits >= 1 && MaxBits + 8 <= BUFFER_BITS, "Codes must leave a byte of the buffer free");
+    static_assert(MaxBits <= 24, "Codes must fit 24 bits");
+    static_assert(TableBits >= 1 && TableBits <= MaxBits && TableBits <= 20,
+                  "The decode table must stay reasonably small");
+
+    // Optimal codes not longer than MaxBits for the counts of symbols 0..counts.size()-1
+    explicit HuffmanCodec(const std::vector<uint64_t>& counts) {
+        std::vector<uint64_t> present;
+        for (const uint64_t count : counts) {
+            if (count != 0)
+                present.push_back(count);
+        }
+
+        const std::vector<uint8_t> limited = limited_code_lengths(present, MaxBits);
+        std::vector<uint8_t> lengths(counts.size(), 0);
+        size_t next = 0;
+        for (size_t symbol = 0; symbol < counts.size(); ++symbol) {
+            if (counts[symbol] != 0)
+                lengths[symbol] = limited[next++];
+        }
+        assign_codes(std::move(lengths));
+    }
+
+    // Codes restored from their lengths, e.g. stored in a header
+    static HuffmanCodec from_lengths(std::vector<uint8_t> lengths) {
+        HuffmanCodec codec;
+        codec.assign_codes(std::move(lengths));
+        return codec;
+    }
+
+    // Counts of every symbol, the alphabet ends at the largest one
+    static std::vector<uint64_t> count(const Symbol* data, size_t size) {
+        std::vector<uint64_t> counts;
+        for (size_t i = 0; i < size; ++i) {
+            if (data[i] >= counts.size())
+                counts.resize(size_t(data[i]) + 1, 0);
+            counts[data[i]]++;
+        }
+        return counts;
+    }
+
+    size_t alphabet_size() const {
+        return lengths_.size();
+    }
+
+    const std::vector<uint8_t>& code_lengths() const {
+        return lengths_;
+    }
+
+    // Throws for symbols without a code
+    size_t encoded_size(const Symbol* data, size_t size) const {
+        uint64_t bits = 0;
+        for (size_t i = 0; i < size; ++i)
+            bits += code(data[i]).length;
+        return static_cast<size_t>((bits + 7) / 8);
+    }
+
+    // Writes encoded_size() bytes to `out`, which must have PADDING writable bytes after them
+    size_t encode(const Symbol* data, size_t size, uint8_t* out) const {
+        BitBuffer buffer = 0;
+        size_t filled = 0;
+        size_t position = 0;
+        for (size_t i = 0; i < size; ++i) {
+            const Code& next = code(data[i]);
+            if (filled + MaxBits >= BUFFER_BITS) {
+                store_big_endian<BitBuffer>(out + position, buffer);
+                const size_t bytes = filled / 8;
+                position += bytes;
+                buffer <<= bytes * 8;
+                filled -= bytes * 8;
+            }
+            buffer |= static_cast<BitBuffer>(next.bits) << (BUFFER_BITS - filled - next.length);
+            filled += next.length;
+        }
+
+        store_big_endian<BitBuffer>(out + position, buffer);
+        return position + (filled + 7) / 8;
+    }
+
+    std::vector<uint8_t> encode(const Symbol* data, size_t size) const {
+        std::vector<uint8_t> out(encoded_size(data, size) + PADDING);
+        out.resize(encode(data, size, out.data()));
+        return out;
+    }
+
+    // Decodes exactly `count` symbols from `size` bytes of `data`, followed by PADDING readable bytes
+    void decode(const uint8_t* data, size_t size, Symbol* out, size_t count) const {
+        size_t position = 0;
+        size_t i = 0;
+        while (i < count) {
+            // One load gives at least BUFFER_BITS - 7 bits, codes are taken while a whole window is left
+            const BitBuffer window = load_big_endian<BitBuffer>(data + std::min(position >> 3, size));
+            BitBuffer bits = window << (position & 7);
+            size_t available = BUFFER_BITS - (position & 7);
+            for (; available >= MaxBits && i < count; ++i) {
+                Entry entry = table_[bits >> (BUFFER_BITS - TableBits)];
+                if (entry.length == 0)
+                    entry = find_long_code(bits);
+                out[i] = entry.symbol;
+                bits <<= entry.length;
+                available -= entry.length;
+                position += entry.length;
+            }
+        }
+
+        if (position > size * 8)
+            throw HuffmanException("Decompressed size doesn't match expected size from meta");
+    }
+
+private:
+    struct Code {
+        uint32_t bits;
+        uint8_t length;
+    };
+
+    struct Entry {
+        Symbol symbol;
+        uint8_t length;
+    };
+
+    // Codes of one length longer than TableBits
+    struct LongCodes {
+        uint64_t first_code;
+        size_t count;
+        size_t first_symbol;
+    };
+
+    HuffmanCodec() = default;
+
+    const Code& code(Symbol symbol) const {
+        if (symbol >= codes_.size() || codes_[symbol].length == 0)
+            throw HuffmanException("Symbol has no code");
+        return codes_[symbol];
+    }
+
+    Entry find_long_code(BitBuffer bits) const {
+        if constexpr (TableBits < MaxBits) {
+            for (size_t length = TableBits + 1; length <= MaxBits; ++length) {
+                const uint64_t code = bits >> (BUFFER_BITS - length);
+                const LongCodes& codes = long_codes_[length - TableBits - 1];
+                if (code >= codes.first_code && code - codes.first_code < codes.count) {
+                    const Symbol symbol = long_symbols_[codes.first_symbol + (code - codes.first_code)];
+                    return Entry{symbol, static_cast<uint8_t>(length)};
+                }
+            }
+        }
+        throw HuffmanException("Invalid code in compressed data");
+    }
+
+    void assign_codes(std::vector<uint8_t> lengths) {
+        if (lengths.size() > size_t(std::numeric_limits<Symbol>::max()) + 1)
+            throw HuffmanException("Alphabet is too big for the symbol type");
+
+        // Canonical codes: consecutive codes for symbols sorted by length and then by value
+        std::vector<size_t> length_count(MaxBits + 1, 0);
+        for (const uint8_t length : lengths) {
+            if (length > MaxBits)
+                throw HuffmanException("Code length must be from 1 to " + std::to_string(MaxBits));
+            length_count[length]++;
+        }
+        length_count[0] = 0;
+
+        std::vector<uint64_t> next_code(MaxBits + 1, 0);
+        uint64_t next = 0;
+        for (size_t length = 1; length <= MaxBits; ++length) {
+            next = (next + length_count[length - 1]) << 1;
+            next_code[length] = next;
+            if (length_count[length] > (uint64_t(1) << length) - next)
+                throw HuffmanException("Code lengths don't form a prefix code");
+        }
+
+        // Long codes of one length are consecutive, their symbols go in the same order
+        long_codes_.assign(MaxBits - TableBits, LongCodes{0, 0, 0});
+        size_t first_symbol = 0;
+        for (size_t length = TableBits + 1; length <= MaxBits; ++length) {
+            long_codes_[length - TableBits - 1] = LongCodes{next_code[length], length_count[length], first_symbol};
+            first_symbol += length_count[length];
+        }
+        long_symbols_.assign(first_symbol, 0);
+
+        codes_.assign(lengths.size(), Code{0, 0});
+        table_.assign(size_t(1) << TableBits, Entry{0, 0});
+        for (size_t symbol = 0; symbol < lengths.size(); ++symbol) {
+            const uint8_t length = lengths[symbol];
+            if (length == 0)
+                continue;
+            const uint32_t bits = static_cast<uint32_t>(next_code[length]++);
+            codes_[symbol] = Code{bits, length};
+
+            if (length > TableBits) {
+                const LongCodes& codes = long_codes_[length - TableBits - 1];
+                long_symbols_[codes.first_symbol + (bits - codes.first_code)] = static_cast<Symbol>(symbol);
+                continue;
+            }
+
+            // Every index starting with the code maps to the symbol
+            const size_t first = size_t(bits) << (TableBits - length);
+            std::fill(table_.begin() + first, table_.begin() + first + (size_t(1) << (TableBits - length)),
+                      Entry{static_cast<Symbol>(symbol), length});
+        }
+        lengths_ = std::move(lengths);
+    }
+
+private:
+    std::vector<uint8_t> lengths_;
+    std::vector<Code> codes_;
+    std::vector<Entry> table_;
+    std::vector<LongCodes> long_codes_;
+    std::vector<Symbol> long_symbols_;
+};
+
+} // namespace huffman
+
+#endif  // HUFFMAN_CODEC_H_
@@ -0,0 +1,386 @@
+#ifndef HUFFMAN_DECODER_H_
+#define HUFFMAN_DECODER_H_
+
+#include "bit_reader.hpp"
+#include "huffman.hpp"
+#include "huffman_exception.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace huffman {
+
+// Decoders may read this many bytes past the end of the compressed data, so buffers must be padded.
+const size_t DECODER_PADDING = BIT_READER_PADDING;
+
+const size_t DEFAULT_TABLE_BITS = 11;
+const size_t MAX_TABLE_BITS = 16;
+
+// Independent streams decoded in the same loop iteration
+const size_t INTERLEAVE_WAYS = 4;
+
+struct DecodeStream {
+    const uint8_t* data;
+    size_t size;
+    uint8_t* out;
+    size_t count;
+};
+
+class IDecoder {
+public:
+    virtual ~IDecoder() = default;
+
+    // Decodes exactly `count` symbols from `size` bytes of `data` into `out`
+    virtual void decode(const uint8_t* data, size_t size, uint8_t* out, size_t count) const = 0;
+    // Decodes every stream, advancing INTERLEAVE_WAYS of them at once
+    virtual void decode_streams(const std::vector<DecodeStream>& streams) const = 0;
+};
+
+// Engines decode from the top of a BitReader window with
+//   size_t decode_symbol(uint64_t window, uint8_t& symbol) - one symbol, returns its code length;
+//   size_t step(uint64_t window, uint8_t* out, size_t& length) - up to STEP_SYMBOLS symbols, returns their count;
+//   size_t lookahead() - bits of the window both of them may look at.
+
+// Flat table indexed by the next `table_bits` bits of the stream, so a symbol costs one table load.
+// Codes longer than the table index are looked up in a short list on a slow path.
+class TableDecoder : public IDecoder {
+public:
+    static const size_t STEP_SYMBOLS = 1;
+
+    explicit TableDecoder(const CodeTable& codes, size_t table_bits = DEFAULT_TABLE_BITS);
+
+    virtual void decode(const uint8_t* data, size_t size, uint8_t* out, size_t count) const override;
+    virtual void decode_streams(const std::vector<DecodeStream>& streams) const override;
+
+    // Decodes the symbol at the top of the window and returns its code length.
+    // lookup() returns 0 instead of searching codes longer than the table.
+    size_t lookup(uint64_t window, uint8_t& symbol) const {
+        const Entry entry = table_[window >> (64 - table_bits_)];
+        symbol = entry.symbol;
+        return entry.length;
+    }
+
+    size_t decode_symbol(uint64_t window, uint8_t& symbol) const {
+        size_t length = lookup(window, symbol);
+        if (length != 0)
+            return length;
+
+        const LongCode& code = find_long_code(window);
+        symbol = code.symbol;
+        return code.length;
+    }
+
+    size_t step(uint64_t window, uint8_t* out, size_t& length) const {
+        length = decode_symbol(window, *out);
+        return 1;
+    }
+
+    size_t lookahead() const {
+        return max_length_;
+    }
+
+private:
+    struct Entry {
+        uint8_t symbol;
+        uint8_t length;
+    };
+
+    struct LongCode {
+        uint64_t bits;
+        uint8_t length;
+        uint8_t symbol;
+    };
+
+    const LongCode& find_long_code(uint64_t window) const;
+
+private:
+    size_t table_bits_;
+    size_t max_length_;
+    std::vector<Entry> table_;
+    std::vector<LongCode> long_codes_;
+};
+
+// Works with canonical codes only: finds the code length by comparing the window with the last code
+// of every length, starting from the shortest length possible for the count of its leading ones.
+// Needs only a few hundred bytes of tables.
+class CanonicalDecoder : public IDecoder {
+public:
+    static const size_t STEP_SYMBOLS = 1;
+
+    explicit CanonicalDecoder(const CodeTable& codes);
+
+    virtual void decode(const uint8_t* data, size_t size, uint8_t* out, size_t count) const override;
+    virtual void decode_streams(const std::vector<DecodeStream>& streams) const override;
+
+    size_t decode_symbol(uint64_t window, uint8_t& symbol) const {
+        size_t length = start_length_[__builtin_clzll(~window | 1)];
+        uint64_t code = window >> (64 - length);
+        while (code >= end_code_[length] && length < max_length_) {
+            ++length;
+            code = window >> (64 - length);
+        }
+        if (code >= end_code_[length])
+            throw HuffmanException("Invalid code in compressed data");
+
+        symbol = symbols_[code + offset_[length]];
+        return length;
+    }
+
+    size_t step(uint64_t window, uint8_t* out, size_t& length) const {
+        length = decode_symbol(window, *out);
+        return 1;
+    }
+
+    size_t lookahead() const {
+        return max_length_;
+    }
+
+private:
+    size_t max_length_;
+    // Right-aligned code following the last code of every length
+    std::array<uint64_t, MAX_CODE_LENGTH + 1> end_code_{};
+    // Index of the first code of every length in symbols_ minus that code
+    std::array<uint64_t, MAX_CODE_LENGTH + 1> offset_{};
+    std::array<uint8_t, 65> start_length_{};
+    std::vector<uint8_t> symbols_;
+};
+
+// Every entry holds all whole codes that fit into the table index (up to MAX_SYMBOLS of them),
+// so short codes are emitted several symbols per table load.
+class MultiSymbolDecoder : public IDecoder {
+public:
+    static const size_t MAX_SYMBOLS = 4;
+    static const size_t STEP_SYMBOLS = MAX_SYMBOLS;
+    static const size_t DEFAULT_BITS = 12;
+
+    explicit MultiSymbolDecoder(const CodeTable& codes, size_t table_bits = DEFAULT_BITS);
+
+    virtual void decode(const uint8_t* data, size_t size, uint8_t* out, size_t count) const override;
+    virtual void decode_streams(const std::vector<DecodeStream>& streams) const override;
+
+    size_t decode_symbol(uint64_t window, uint8_t& symbol) const {
+        return single_.decode_symbol(window, symbol);
+    }
+
+    // Writes MAX_SYMBOLS bytes to `out`, but only the returned count of them are decoded symbols
+    size_t step(uint64_t window, uint8_t* out, size_t& length) const {
+        const Entry& entry = table_[window >> (64 - table_bits_)];
+        if (entry.count == 0) {
+            length = single_.decode_symbol(window, *out);
+            return 1;
+        }
+
+        std::copy(entry.symbols, entry.symbols + MAX_SYMBOLS, out);
+        length = entry.length;
+        return entry.count;
+    }
+
+    // Trailing symbols of an entry come from the whole table index
+    size_t lookahead() const {
+        return std::max(table_bits_, single_.lookahead());
+    }
+
+private:
+    struct Entry {
+        uint8_t symbols[MAX_SYMBOLS];
+        uint8_t count;
+        uint8_t length;
+    };
+
+private:
+    // Decodes the last symbols and codes longer than the table
+    TableDecoder single_;
+    size_t table_bits_;
+    std::vector<Entry> table_;
+};
+
+// Small primary table for short codes whose entries point to sub-tables for the rare long ones.
+// The primary table stays L1-resident and codes up to PRIMARY + MAX_SUB_BITS bits take at most
+// two lookups, longer codes (only possible on very skewed frequencies) chain more sub-tables.
+class TwoLevelDecoder : public IDecoder {
+public:
+    static const size_t STEP_SYMBOLS = 1;
+    static const size_t DEFAULT_PRIMARY_BITS = 10;
+    static const size_t MAX_SUB_BITS = 14;
+
+    explicit TwoLevelDecoder(const CodeTable& codes, size_t primary_bits = DEFAULT_PRIMARY_BITS);
+
+    virtual void decode(const uint8_t* data, size_t size, uint8_t* out, size_t count) const override;
+    virtual void decode_streams(const std::vector<DecodeStream>& streams) const override;
+
+    size_t decode_symbol(uint64_t window, uint8_t& symbol) const {
+        uint32_t entry = entries_[window >> (64 - primary_bits_)];
+        size_t skip = primary_bits_;
+        while (entry & LINK_FLAG) {
+            const size_t bits = (entry >> LINK_BITS_SHIFT) & LINK_BITS_MASK;
+            entry = entries_[(entry & LINK_OFFSET_MASK) + ((window << skip) >> (64 - bits))];
+            skip += bits;
+        }
+
+        const size_t length = (entry >> 8) & 0xFF;
+        if (length == 0)
+            throw HuffmanException("Invalid code in compressed data");
+        symbol = static_cast<uint8_t>(entry);
+        return length;
+    }
+
+    size_t step(uint64_t window, uint8_t* out, size_t& length) const {
+        length = decode_symbol(window, *out);
+        return 1;
+    }
+
+    size_t lookahead() const {
+        return max_length_;
+    }
+
+private:
+    // A symbol entry keeps the symbol in the low byte and the whole code length in the next one,
+    // a link keeps the sub-table offset and its index bits.
+    static const uint32_t LINK_FLAG = uint32_t(1) << 31;
+    static const size_t LINK_BITS_SHIFT = 26;
+    static const uint32_t LINK_BITS_MASK = 0x1F;
+    static const uint32_t LINK_OFFSET_MASK = (uint32_t(1) << LINK_BITS_SHIFT) - 1;
+
+    struct SymbolCode {
+        uint64_t bits;
+        uint8_t length;
+        uint8_t symbol;
+    };
+
+    // Appends a table indexed by `bits` bits after a common `prefix_length`-bit prefix, returns its offset
+    size_t build_table(const std::vector<SymbolCode>& codes, size_t prefix_length, size_t bits);
+
+private:
+    size_t primary_bits_;
+    size_t max_length_;
+    std::vector<uint32_t> entries_;
+};
+
+// The code tree flattened into an array of 16-bit child indices, two per internal node with the root at 0.
+// Walks the window bit by bit, but needs only about 1 KiB for a full alphabet and builds no tables.
+class TreeDecoder : public IDecoder {
+public:
+    static const size_t STEP_SYMBOLS = 1;
+
+    explicit TreeDecoder(const CodeTable& codes);
+
+    virtual void decode(const uint8_t* data, size_t size, uint8_t* out, size_t count) const override;
+    virtual void decode_streams(const std::vector<DecodeStream>& streams) const override;
+
+    size_t decode_symbol(uint64_t window, uint8_t& symbol) const {
+        uint16_t child = children_[window >> 63];
+        size_t length = 1;
+        while (!(child & LEAF_FLAG)) {
+            if (child == MISSING_CHILD)
+                throw HuffmanException("Invalid code in compressed data");
+            window <<= 1;
+            child = children_[2 * child + (window >> 63)];
+            ++length;
+        }
+
+        symbol = static_cast<uint8_t>(child);
+        return length;
+    }
+
+    size_t step(uint64_t window, uint8_t* out, size_t& length) const {
+        length = decode_symbol(window, *out);
+        return 1;
+    }
+
+    size_t lookahead() const {
+        return max_length_;
+    }
+
+    // Bytes taken by the tree
+    size_t memory_size() const {
+        return children_.size() * sizeof(uint16_t);
+    }
+
+    size_t node_count() const {
+        return children_.size() / 2;
+    }
+
+    uint16_t child(size_t node, size_t bit) const {
+        return children_[2 * node + bit];
+    }
+
+    // A leaf keeps its symbol in the low byte, the root is never a child so 0 marks a missing one
+    static constexpr uint16_t LEAF_FLAG = 0x8000;
+    static constexpr uint16_t MISSING_CHILD = 0;
+
+private:
+    size_t max_length_;
+    std::vector<uint16_t> children_;
+};
+
+// Finite-state machine over whole input bytes (Choueka, Klein et al.): a state is an internal node
+// of the code tree and every (state, byte) pair has the next state and the symbols the byte completes.
+// Decoding does one transition per input byte with no bit shifting, but the table takes
+// 12 bytes * 256 per internal node, about 750 KiB for a full alphabet.
+class StateMachineDecoder : public IDecoder {
+public:
+    // Internal nodes of a complete code over bytes
+    static const size_t MAX_STATES = 255;
+
+    explicit StateMachineDecoder(const CodeTable& codes);
+
+    virtual void decode(const uint8_t* data, size_t size, uint8_t* out, size_t count) const override;
+    virtual void decode_streams(const std::vector<DecodeStream>& streams) const override;
+
+private:
+    static const uint16_t INVALID_STATE = 0xFFFF;
+
+    // `count` symbols complete within the byte, a byte leaving the tree ends with INVALID_STATE
+    struct Transition {
+        uint8_t symbols[8];
+        uint16_t next;
+        uint8_t count;
+    };
+
+private:
+    std::vector<Transition> transitions_;
+};
+
+// Decodes groups of WAYS streams with AVX2: a step gathers the next bits of every stream of the group
+// and then their entries of a flat table covering the longest code, so eight lookups go at once.
+// The CPU is checked at run time. Without AVX2, for the leftover streams and for a single stream
+// the scalar TableDecoder is used.
+class GatherDecoder : public IDecoder {
+public:
+    static const size_t WAYS = 8;
+
+    explicit GatherDecoder(const CodeTable& codes);
+
+    virtual void decode(const uint8_t* data, size_t size, uint8_t* out, size_t count) const override;
+    virtual void decode_streams(const std::vector<DecodeStream>& streams) const override;
+
+    static bool supported();
+
+private:
+    void decode_group(const DecodeStream* streams) const;
+
+private:
+    TableDecoder single_;
+    size_t table_bits_;
+    // Symbol in the low byte and code length in the next one
+    std::vector<uint16_t> table_;
+};
+
+enum class DecoderType {
+    Auto,
+    Table,
+    Canonical,
+    MultiSymbol,
+    TwoLevel,
+    Tree,
+    StateMachine,
+    Gather,
+};
+
+std::unique_ptr<IDecoder> make_decoder(DecoderType type, const CodeTable& codes);
+
+} // namespace huffman
+
+#endif  // HUFFMAN_DECODER_H_
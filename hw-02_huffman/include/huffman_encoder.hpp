@@ -0,0 +1,92 @@
+#ifndef HUFFMAN_ENCODER_H_
+#define HUFFMAN_ENCODER_H_
+
+#include "bit_writer.hpp"
+#include "huffman.hpp"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+namespace huffman {
+
+class IEncoder {
+public:
+    virtual ~IEncoder() = default;
+
+    // Appends the codes of every byte of `data` to `writer`
+    virtual void encode(std::string_view data, BitWriter& writer) const = 0;
+};
+
+// One table load and one write per input byte
+class SymbolEncoder : public IEncoder {
+public:
+    explicit SymbolEncoder(const CodeTable& codes);
+
+    virtual void encode(std::string_view data, BitWriter& writer) const override;
+
+private:
+    CodeTable codes_;
+};
+
+// Table indexed by two consecutive input bytes holding both codes together, so short codes take
+// one load and one write per two bytes. Pairs longer than MAX_BITS go through the single codes.
+class PairEncoder : public IEncoder {
+public:
+    static const size_t MAX_BITS = 24;
+
+    explicit PairEncoder(const CodeTable& codes);
+
+    virtual void encode(std::string_view data, BitWriter& writer) const override;
+
+private:
+    CodeTable codes_;
+    // Codes in the high 24 bits and their length in the low byte, 0 for long pairs
+    std::vector<uint32_t> pairs_;
+};
+
+// Packs codes straight into bytes: lengths of a batch of 8 symbols are prefix-summed into shifts and
+// as many codes as fit are ORed into a 64-bit word before one unaligned big-endian store.
+// The kernel is built twice, with BMI2 flag-free shifts chosen at run time and a portable fallback.
+class BatchEncoder : public IEncoder {
+public:
+    static const size_t BATCH = 8;
+
+    explicit BatchEncoder(const CodeTable& codes);
+
+    virtual void encode(std::string_view data, BitWriter& writer) const override;
+
+    static bool bmi2_supported();
+
+private:
+    std::array<uint64_t, 256> bits_{};
+    std::array<uint8_t, 256> lengths_{};
+    // Codes of a batch stored at once, so the word never holds more than 63 bits
+    size_t group_;
+};
+
+enum class EncoderType {
+    Auto,
+    Symbol,
+    Pair,
+    Batch,
+};
+
+// Below this many bytes per thread a chunk isn't worth a thread
+const size_t PARALLEL_MIN_CHUNK = size_t(1) << 20;
+
+// Encodes `data` into exactly `size` bytes at `out` with up to `threads` threads, the bytes are the same
+// as from one BitWriter. Every chunk's bit offset comes from a prefix sum of the chunks' bit counts,
+// chunks are encoded into their own buffers and the bytes shared by two chunks are merged with OR.
+void encode_parallel(const IEncoder& encoder, const CodeLengths& lengths, std::string_view data,
+                     uint8_t* out, size_t size, size_t threads);
+
+// Auto takes the batch encoder unless the data is shorter than one batch
+EncoderType resolve_encoder_type(EncoderType type, size_t data_size);
+std::unique_ptr<IEncoder> make_encoder(EncoderType type, const CodeTable& codes, size_t data_size);
+
+} // namespace huffman
+
+#endif  // HUFFMAN_ENCODER_H_
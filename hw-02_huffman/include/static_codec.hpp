@@ -0,0 +1,89 @@
+#ifndef STATIC_CODEC_H_
+#define STATIC_CODEC_H_
+
+#include "bit_reader.hpp"
+#include "bit_writer.hpp"
+#include "code_lengths.hpp"
+#include "huffman.hpp"
+#include "huffman_decoder.hpp"
+#include "huffman_exception.hpp"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+namespace huffman {
+
+constexpr size_t max_code_length(const CodeLengths& lengths) {
+    size_t result = 0;
+    for (const uint8_t length : lengths)
+        result = length > result ? length : result;
+    return result;
+}
+
+// Flat decode table over the next `Bits` bits: symbol in the low byte and code length in the next one,
+// zero for bit patterns no code starts with
+template<size_t Bits>
+constexpr std::array<uint16_t, size_t(1) << Bits> static_decode_table(const CodeTable& codes) {
+    std::array<uint16_t, size_t(1) << Bits> table{};
+    for (size_t symbol = 0; symbol < codes.size(); ++symbol) {
+        const CodeWord& code = codes[symbol];
+        if (code.length == 0)
+            continue;
+
+        // Every index starting with the code maps to the symbol
+        const size_t first = code.bits << (Bits - code.length);
+        const size_t last = first + (size_t(1) << (Bits - code.length));
+        for (size_t index = first; index < last; ++index)
+            table[index] = static_cast<uint16_t>(symbol | (size_t(code.length) << 8));
+    }
+    return table;
+}
+
+// Huffman codec for a byte distribution known at build time. `Distribution::counts` is a constexpr
+// Histogram; code lengths, canonical codes and the decode table are computed by the compiler and
+// land in read-only data, so a stream needs neither a tree build nor codes in a header.
+// Codes must fit the table, at most MAX_TABLE_BITS long.
+template<typename Distribution>
+class StaticCodec {
+public:
+    static constexpr CodeLengths lengths = huffman_code_lengths(Distribution::counts);
+    static constexpr CodeTable codes = canonical_code_table(lengths);
+    static constexpr size_t TABLE_BITS = max_code_length(lengths);
+
+    static_assert(TABLE_BITS != 0, "The distribution must have at least one symbol");
+    static_assert(TABLE_BITS <= MAX_TABLE_BITS, "Codes of the distribution are too long for a flat table");
+
+    static constexpr std::array<uint16_t, size_t(1) << TABLE_BITS> table = static_decode_table<TABLE_BITS>(codes);
+
+    // Throws for bytes the distribution doesn't have
+    static void encode(std::string_view data, BitWriter& writer) {
+        for (const char c : data) {
+            const CodeWord& code = codes[static_cast<uint8_t>(c)];
+            if (code.length == 0)
+                throw HuffmanException("Symbol has no code in the static table");
+            writer.write(code.bits, code.length);
+        }
+    }
+
+    // Decodes exactly `count` symbols from `size` bytes of `data`, followed by DECODER_PADDING readable bytes
+    static void decode(const uint8_t* data, size_t size, uint8_t* out, size_t count) {
+        BitReader reader(data, size);
+        for (size_t i = 0; i < count; ++i) {
+            if (reader.available() < TABLE_BITS)
+                reader.refill();
+            const uint16_t entry = table[reader.peek(TABLE_BITS)];
+            if (entry == 0)
+                throw HuffmanException("Invalid code in compressed data");
+            out[i] = static_cast<uint8_t>(entry);
+            reader.consume(entry >> 8);
+        }
+
+        if (reader.overrun())
+            throw HuffmanException("Decompressed size doesn't match expected size from meta");
+    }
+};
+
+} // namespace huffman
+
+#endif  // STATIC_CODEC_H_
@@ -0,0 +1,54 @@
+#ifndef TOKENIZER_H_
+#define TOKENIZER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+namespace huffman {
+
+// Token ids fit 16 bits: ids below 256 are single bytes, dictionary words follow them
+const size_t TOKEN_ALPHABET_SIZE = size_t(1) << 16;
+const size_t TOKEN_BYTE_IDS = 256;
+const size_t MAX_TOKEN_LENGTH = 255;
+// Writable bytes expand_tokens() needs after the output, so short tokens are copied with one fixed move
+const size_t TOKEN_PADDING = 16;
+
+struct Tokenization {
+    // Words in the order of their first appearance, word i has id TOKEN_BYTE_IDS + i
+    std::vector<std::string_view> words;
+    std::vector<uint16_t> ids;
+};
+
+// Splits `data` into runs of word bytes (letters, digits, '_' and non-ASCII bytes) and runs of the other
+// bytes, at most MAX_TOKEN_LENGTH long. Runs of two or more bytes become dictionary words while the
+// dictionary has room, the rest goes as single bytes. The words point into `data`.
+Tokenization tokenize(std::string_view data);
+
+// Token bytes laid out for decoding: one lookup gives a token's place and length
+class TokenTable {
+public:
+    explicit TokenTable(const std::vector<std::string_view>& words);
+
+    size_t size() const {
+        return entries_.size();
+    }
+
+    // Writes the bytes of `count` tokens to `out` and returns how many, throws if they don't fit `size`
+    size_t expand(const uint16_t* ids, size_t count, uint8_t* out, size_t size) const;
+
+private:
+    struct Entry {
+        uint32_t offset;
+        uint32_t length;
+    };
+
+    std::vector<Entry> entries_;
+    // Single bytes, then the words, then TOKEN_PADDING readable bytes
+    std::vector<uint8_t> bytes_;
+};
+
+} // namespace huffman
+
+#endif  // TOKENIZER_H_
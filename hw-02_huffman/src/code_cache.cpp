@@ -0,0 +1,107 @@
+#include "code_cache.hpp"
+#include "huffman_exception.hpp"
+
+namespace huffman {
+
+namespace {
+
+uint64_t hash_codes(const CodeTable& codes) {
+    // FNV-1a over the lengths and bits of every code
+    uint64_t hash = 0xCBF29CE484222325;
+    auto mix = [&hash](uint64_t value) {
+        hash = (hash ^ value) * 0x100000001B3;
+    };
+    for (const CodeWord& code : codes) {
+        mix(code.length);
+        mix(code.bits);
+    }
+    return hash;
+}
+
+bool same_codes(const CodeTable& left, const CodeTable& right) {
+    for (size_t symbol = 0; symbol < left.size(); ++symbol) {
+        if (left[symbol].length != right[symbol].length || left[symbol].bits != right[symbol].bits)
+            return false;
+    }
+    return true;
+}
+
+} // anonymous namespace
+
+CodeCache::CodeCache(size_t capacity) : capacity_(capacity), hits_(0), misses_(0) {
+    if (capacity_ == 0)
+        throw HuffmanException("Code cache capacity must be positive");
+}
+
+CodeCache& CodeCache::global() {
+    static CodeCache cache;
+    return cache;
+}
+
+std::shared_ptr<const IEncoder> CodeCache::encoder(const CodeTable& codes, EncoderType type, size_t data_size) {
+    type = resolve_encoder_type(type, data_size);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::shared_ptr<const IEncoder>& encoder = lookup(codes).encoders.at(static_cast<size_t>(type));
+    if (encoder) {
+        ++hits_;
+    } else {
+        ++misses_;
+        encoder = make_encoder(type, codes, data_size);
+    }
+    return encoder;
+}
+
+std::shared_ptr<const IDecoder> CodeCache::decoder(const CodeTable& codes, DecoderType type) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::shared_ptr<const IDecoder>& decoder = lookup(codes).decoders.at(static_cast<size_t>(type));
+    if (decoder) {
+        ++hits_;
+    } else {
+        ++misses_;
+        decoder = make_decoder(type, codes);
+    }
+    return decoder;
+}
+
+CodeCacheStats CodeCache::stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return CodeCacheStats{hits_, misses_, entries_.size()};
+}
+
+void CodeCache::clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_.clear();
+    index_.clear();
+    hits_ = 0;
+    misses_ = 0;
+}
+
+CodeCache::Entry& CodeCache::lookup(const CodeTable& codes) {
+    const uint64_t hash = hash_codes(codes);
+    auto range = index_.equal_range(hash);
+    for (auto it = range.first; it != range.second; ++it) {
+        if (same_codes(it->second->codes, codes)) {
+            entries_.splice(entries_.begin(), entries_, it->second);
+            return entries_.front();
+        }
+    }
+
+    if (entries_.size() == capacity_) {
+        const uint64_t oldest = hash_codes(entries_.back().codes);
+        range = index_.equal_range(oldest);
+        for (auto it = range.first; it != range.second; ++it) {
+            if (it->second == std::prev(entries_.end())) {
+                index_.erase(it);
+                break;
+            }
+        }
+        entries_.pop_back();
+    }
+
+    entries_.push_front(Entry{codes, {}, {}});
+    index_.emplace(hash, entries_.begin());
+    return entries_.front();
+}
+
+} // namespace huffman
@@ -0,0 +1,118 @@
+#include "histogram.hpp"
+#include "huffman_exception.hpp"
+#include <algorithm>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+namespace huffman {
+
+namespace {
+
+// 32-bit counters halve the tables, a block never overflows them
+const size_t HISTOGRAM_BLOCK_SIZE = size_t(1) << 30;
+
+// splitmix64, enough to spread the sampled blocks
+uint64_t next_random(uint64_t& state) {
+    uint64_t z = (state += 0x9E3779B97F4A7C15);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EB;
+    return z ^ (z >> 31);
+}
+
+} // anonymous namespace
+
+Histogram count_bytes(const uint8_t* data, size_t size) {
+    Histogram histogram{};
+    uint32_t tables[HISTOGRAM_TABLES][256];
+
+    for (size_t begin = 0; begin < size; begin += HISTOGRAM_BLOCK_SIZE) {
+        std::memset(tables, 0, sizeof(tables));
+        const uint8_t* bytes = data + begin;
+        const size_t block = std::min(HISTOGRAM_BLOCK_SIZE, size - begin);
+
+        // One 8-byte load feeds the four tables twice
+        size_t i = 0;
+        for (; i + 8 <= block; i += 8) {
+            uint64_t word;
+            std::memcpy(&word, bytes + i, sizeof(word));
+            tables[0][word & 0xFF]++;
+            tables[1][(word >> 8) & 0xFF]++;
+            tables[2][(word >> 16) & 0xFF]++;
+            tables[3][(word >> 24) & 0xFF]++;
+            tables[0][(word >> 32) & 0xFF]++;
+            tables[1][(word >> 40) & 0xFF]++;
+            tables[2][(word >> 48) & 0xFF]++;
+            tables[3][word >> 56]++;
+        }
+        for (; i < block; ++i)
+            tables[0][bytes[i]]++;
+
+        for (size_t value = 0; value < 256; ++value) {
+            for (size_t table = 0; table < HISTOGRAM_TABLES; ++table)
+                histogram[value] += tables[table][value];
+        }
+    }
+
+    return histogram;
+}
+
+Histogram count_bytes_parallel(const uint8_t* data, size_t size, size_t threads) {
+    const size_t chunks = std::max<size_t>(1, std::min(threads, size / HISTOGRAM_MIN_CHUNK));
+    if (chunks == 1)
+        return count_bytes(data, size);
+
+    const size_t chunk_length = (size + chunks - 1) / chunks;
+    std::vector<Histogram> partial(chunks);
+    auto job = [&](size_t i) {
+        const size_t begin = std::min(i * chunk_length, size);
+        partial[i] = count_bytes(data + begin, std::min(chunk_length, size - begin));
+    };
+
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < chunks; ++i)
+        workers.emplace_back(job, i);
+    job(0);
+    for (std::thread& worker : workers)
+        worker.join();
+
+    Histogram histogram{};
+    for (const Histogram& counts : partial) {
+        for (size_t value = 0; value < histogram.size(); ++value)
+            histogram[value] += counts[value];
+    }
+    return histogram;
+}
+
+Histogram sample_bytes(const uint8_t* data, size_t size, const SamplingOptions& options) {
+    if (options.mode == SamplingMode::None)
+        throw HuffmanException("Sampling mode is not set");
+    if (options.block_size == 0 || options.stride == 0)
+        throw HuffmanException("Sampling block size and stride must be positive");
+
+    Histogram sampled{};
+    size_t sampled_bytes = 0;
+    uint64_t state = options.seed;
+    const size_t blocks = (size + options.block_size - 1) / options.block_size;
+    for (size_t group = 0; group < blocks; group += options.stride) {
+        size_t block = group;
+        if (options.mode == SamplingMode::Random)
+            block += next_random(state) % std::min(options.stride, blocks - group);
+
+        const size_t begin = block * options.block_size;
+        const size_t length = std::min(options.block_size, size - begin);
+        const Histogram counts = count_bytes(data + begin, length);
+        for (size_t value = 0; value < sampled.size(); ++value)
+            sampled[value] += counts[value];
+        sampled_bytes += length;
+    }
+
+    // Values the samples missed get a count of one: their codes are long, but they exist
+    Histogram histogram{};
+    const double scale = sampled_bytes == 0 ? 0 : static_cast<double>(size) / sampled_bytes;
+    for (size_t value = 0; value < histogram.size(); ++value)
+        histogram[value] = std::max<uint64_t>(1, static_cast<uint64_t>(sampled[value] * scale + 0.5));
+    return histogram;
+}
+
+} // namespace huffman
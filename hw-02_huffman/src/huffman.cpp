@@ -1,74 +1,306 @@
 #include "huffman.hpp"
+#include "code_lengths.hpp"
+#include "huffman_exception.hpp"
+#include <algorithm>
 
 namespace huffman {
 
-// HuffmanTree
+CodeWord make_code_word(const std::string& code) {
+    if (code.empty() || code.size() > MAX_CODE_LENGTH)
+        throw HuffmanException("Code length must be from 1 to " + std::to_string(MAX_CODE_LENGTH));
+
+    uint64_t bits = 0;
+    for (const char bit : code) {
+        if (bit != '0' && bit != '1')
+            throw HuffmanException("Code must consist of 0 and 1");
+        bits = (bits << 1) | static_cast<uint64_t>(bit - '0');
+    }
+
+    return CodeWord{bits, static_cast<uint8_t>(code.size())};
+}
+
+std::string code_to_string(const CodeWord& code) {
+    std::string result(code.length, '0');
+    for (size_t i = 0; i < code.length; ++i) {
+        if ((code.bits >> (code.length - 1 - i)) & 1)
+            result[i] = '1';
+    }
+    return result;
+}
 
-HuffmanTree::HuffmanTree(const std::map<uint8_t, size_t>& freqMap) {
-    build_tree(freqMap);
+CodeTable make_code_table(const std::map<uint8_t, std::string>& codes) {
+    CodeTable table{};
+    for (auto& pair : codes)
+        table[pair.first] = make_code_word(pair.second);
+    return table;
 }
 
-HuffmanTree::~HuffmanTree() {
-    delete_tree(root_);
+CodeTable make_canonical_codes(const CodeLengths& lengths) {
+    return canonical_code_table(lengths);
 }
 
-void HuffmanTree::delete_tree(Node* node) {
-    if (node) {
-        delete_tree(node->left);
-        delete_tree(node->right);
-        delete node;
+bool is_canonical(const CodeTable& codes) {
+    CodeLengths lengths{};
+    for (size_t symbol = 0; symbol < codes.size(); ++symbol)
+        lengths[symbol] = codes[symbol].length;
+
+    const CodeTable canonical = make_canonical_codes(lengths);
+    for (size_t symbol = 0; symbol < codes.size(); ++symbol) {
+        if (codes[symbol].length != 0 && codes[symbol].bits != canonical[symbol].bits)
+            return false;
     }
+    return true;
 }
 
-void HuffmanTree::build_tree(const std::map<uint8_t, size_t>& freqMap) {
-    if (freqMap.empty()) {
-        root_ = nullptr;
-        return;
+void check_prefix_free(const CodeTable& codes) {
+    // After sorting left-aligned codes a prefix always ends up right before one of its extensions
+    std::vector<CodeWord> sorted;
+    for (const CodeWord& code : codes) {
+        if (code.length > MAX_CODE_LENGTH)
+            throw HuffmanException("Code length must be from 1 to " + std::to_string(MAX_CODE_LENGTH));
+        if (code.length != 0)
+            sorted.push_back(code);
     }
 
-    auto compare = [](const Node* left, const Node* right) {
-        return left->freq > right->freq;
+    auto aligned = [](const CodeWord& code) {
+        return code.bits << (64 - code.length);
     };
+    std::sort(sorted.begin(), sorted.end(), [&aligned](const CodeWord& left, const CodeWord& right) {
+        if (aligned(left) != aligned(right))
+            return aligned(left) < aligned(right);
+        return left.length < right.length;
+    });
+
+    for (size_t i = 1; i < sorted.size(); ++i) {
+        const CodeWord& prev = sorted[i - 1];
+        const CodeWord& next = sorted[i];
+        if (next.length >= prev.length && (next.bits >> (next.length - prev.length)) == prev.bits)
+            throw HuffmanException("Codes must be prefix-free");
+    }
+}
 
-    std::priority_queue<Node*, std::vector<Node*>, decltype(compare)> minHeap(compare);
+std::vector<uint8_t> limited_code_lengths(const std::vector<uint64_t>& freqs, size_t max_length) {
+    const size_t n = freqs.size();
+    if (n <= 1)
+        return std::vector<uint8_t>(n, 1);
+    if (max_length == 0 || max_length > MAX_CODE_LENGTH || (uint64_t(1) << max_length) < n)
+        throw HuffmanException("Max code length is too small for the alphabet");
 
-    for (auto& pair : freqMap)
-        minHeap.push(new Node(pair.first, pair.second));
+    // Items are leaves (coins of the lightest symbols) and packages of two items of the previous level
+    struct Item {
+        uint64_t weight;
+        int64_t left;   // -1 for a leaf
+        int64_t right;  // leaf index for a leaf
+    };
+
+    std::vector<size_t> order(n);
+    for (size_t i = 0; i < n; ++i)
+        order[i] = i;
+    std::stable_sort(order.begin(), order.end(), [&freqs](size_t left, size_t right) {
+        return freqs[left] < freqs[right];
+    });
 
-    while (minHeap.size() != 1) {
-        Node* left = minHeap.top();
-        minHeap.pop();
+    std::vector<Item> items;
+    for (size_t i = 0; i < n; ++i)
+        items.push_back(Item{freqs[order[i]], -1, static_cast<int64_t>(i)});
 
-        Node* right = minHeap.top();
-        minHeap.pop();
+    // Only the 2n - 2 lightest items of a level can take part in the answer
+    const size_t needed = 2 * n - 2;
+    std::vector<int64_t> level;
+    for (size_t i = 0; i < n; ++i)
+        level.push_back(static_cast<int64_t>(i));
 
-        auto top = new Node(0, left->freq + right->freq);
-        top->left = left;
-        top->right = right;
+    for (size_t depth = 1; depth < max_length; ++depth) {
+        std::vector<int64_t> packages;
+        for (size_t i = 0; i + 1 < level.size(); i += 2) {
+            items.push_back(Item{items[level[i]].weight + items[level[i + 1]].weight, level[i], level[i + 1]});
+            packages.push_back(static_cast<int64_t>(items.size() - 1));
+        }
 
-        minHeap.push(top);
+        std::vector<int64_t> merged;
+        size_t leaf = 0;
+        size_t package = 0;
+        while (merged.size() < needed && (leaf < n || package < packages.size())) {
+            if (package == packages.size() ||
+                (leaf < n && items[leaf].weight <= items[packages[package]].weight))
+                merged.push_back(static_cast<int64_t>(leaf++));
+            else
+                merged.push_back(packages[package++]);
+        }
+        level.swap(merged);
     }
 
-    if (!minHeap.empty())
-        root_ = minHeap.top();
+    // Every occurrence of a leaf in the chosen items adds one bit to its code
+    std::vector<uint8_t> lengths(n, 0);
+    std::vector<int64_t> stack(level.begin(), level.begin() + std::min(needed, level.size()));
+    while (!stack.empty()) {
+        const Item& item = items[stack.back()];
+        stack.pop_back();
+        if (item.left < 0) {
+            lengths[order[item.right]]++;
+        } else {
+            stack.push_back(item.left);
+            stack.push_back(item.right);
+        }
+    }
+
+    return lengths;
+}
+
+// HuffmanTree
+
+namespace {
+
+Histogram make_histogram(const std::map<uint8_t, size_t>& freqMap) {
+    Histogram histogram{};
+    for (auto& pair : freqMap)
+        histogram[pair.first] = pair.second;
+    return histogram;
+}
+
+} // anonymous namespace
+
+HuffmanTree::HuffmanTree(const std::map<uint8_t, size_t>& freqMap, CodeAssignment assignment,
+                         size_t max_code_length)
+    : HuffmanTree(make_histogram(freqMap), assignment, max_code_length) {}
+
+HuffmanTree::HuffmanTree(const Histogram& histogram, CodeAssignment assignment, size_t max_code_length) {
+    if (max_code_length == 0 || max_code_length > MAX_CODE_LENGTH)
+        throw HuffmanException("Max code length must be from 1 to " + std::to_string(MAX_CODE_LENGTH));
+
+    // Canonical codes only need the lengths, tree-shaped ones follow the branches of the merge tree
+    if (assignment == CodeAssignment::Canonical)
+        codeLengths_ = huffman_code_lengths(histogram);
+    else
+        build_tree(histogram);
+    unlimitedCompressedBits_ = count_compressed_bits(histogram);
+
+    if (*std::max_element(codeLengths_.begin(), codeLengths_.end()) > max_code_length) {
+        // The tree is too deep, its shape can't give the codes anymore
+        limit_code_lengths(histogram, max_code_length);
+        assignment = CodeAssignment::Canonical;
+    }
+    compressedBits_ = count_compressed_bits(histogram);
 
-    generateCodeHelper(root_, "");
+    if (assignment == CodeAssignment::Canonical)
+        assign_canonical_codes();
 }
 
-void HuffmanTree::generateCodeHelper(Node* node, const std::string& code) {
-    if (node->right)
-        generateCodeHelper(node->right, code + "1");
-    if (node->left)
-        generateCodeHelper(node->left, code + "0");
-    
-    if (node->right || node->left)
+void HuffmanTree::build_tree(const Histogram& histogram) {
+    // Same heap operations as a std::priority_queue of nodes, so ties are broken like in the legacy format
+    std::array<Node, 2 * 256 - 1> nodes{};
+    std::array<uint16_t, 256> heap{};
+    auto compare = [&nodes](uint16_t left, uint16_t right) {
+        return nodes[left].freq > nodes[right].freq;
+    };
+
+    // Symbols go in ascending order like they come from a map, so the tree shape doesn't depend on the source
+    size_t count = 0;
+    for (size_t symbol = 0; symbol < histogram.size(); ++symbol) {
+        if (histogram[symbol] == 0)
+            continue;
+        nodes[count] = Node{histogram[symbol], 0, 0, static_cast<uint8_t>(symbol)};
+        heap[count] = static_cast<uint16_t>(count);
+        ++count;
+        std::push_heap(heap.begin(), heap.begin() + count, compare);
+    }
+    if (count == 0)
         return;
-    
-    symbolCodes_.emplace(node->data, code == "" ? "0" : code);
+
+    const size_t leaves = count;
+    size_t size = count;
+    while (size != 1) {
+        std::pop_heap(heap.begin(), heap.begin() + size--, compare);
+        const uint16_t left = heap[size];
+        std::pop_heap(heap.begin(), heap.begin() + size--, compare);
+        const uint16_t right = heap[size];
+
+        nodes[count] = Node{nodes[left].freq + nodes[right].freq, left, right, 0};
+        heap[size++] = static_cast<uint16_t>(count++);
+        std::push_heap(heap.begin(), heap.begin() + size, compare);
+    }
+
+    generate_codes(nodes.data(), leaves, heap[0]);
+}
+
+// Bits of codes deeper than 64 are lost, but such trees exceed MAX_CODE_LENGTH and get length-limited codes
+void HuffmanTree::generate_codes(const Node* nodes, size_t leaves, size_t root) {
+    struct Entry {
+        uint16_t node;
+        uint8_t length;
+        uint64_t bits;
+    };
+
+    // A path is at most 255 nodes long and holds one pending sibling per node
+    std::array<Entry, 256> stack{};
+    size_t top = 0;
+    stack[top++] = Entry{static_cast<uint16_t>(root), 0, 0};
+    while (top != 0) {
+        const Entry entry = stack[--top];
+        const Node& node = nodes[entry.node];
+        if (entry.node >= leaves) {
+            const uint8_t length = static_cast<uint8_t>(entry.length + 1);
+            stack[top++] = Entry{node.left, length, entry.bits << 1};
+            stack[top++] = Entry{node.right, length, (entry.bits << 1) | 1};
+            continue;
+        }
+
+        // A single symbol still takes one bit
+        const uint8_t code_length = entry.length == 0 ? 1 : entry.length;
+        symbolCodes_[node.data] = CodeWord{entry.bits, code_length};
+        codeLengths_[node.data] = code_length;
+    }
+}
+
+void HuffmanTree::assign_canonical_codes() {
+    symbolCodes_ = make_canonical_codes(codeLengths_);
+}
+
+void HuffmanTree::limit_code_lengths(const Histogram& histogram, size_t max_code_length) {
+    std::vector<uint64_t> freqs;
+    for (const uint64_t count : histogram) {
+        if (count != 0)
+            freqs.push_back(count);
+    }
+
+    const std::vector<uint8_t> lengths = limited_code_lengths(freqs, max_code_length);
+    size_t i = 0;
+    for (size_t symbol = 0; symbol < histogram.size(); ++symbol) {
+        if (histogram[symbol] != 0)
+            codeLengths_[symbol] = lengths[i++];
+    }
+}
+
+uint64_t HuffmanTree::count_compressed_bits(const Histogram& histogram) const {
+    uint64_t bits = 0;
+    for (size_t symbol = 0; symbol < histogram.size(); ++symbol)
+        bits += histogram[symbol] * codeLengths_[symbol];
+    return bits;
 }
 
 std::map<uint8_t, std::string> HuffmanTree::get_codes() const {
+    std::map<uint8_t, std::string> codes;
+    for (size_t symbol = 0; symbol < symbolCodes_.size(); ++symbol) {
+        if (symbolCodes_[symbol].length != 0)
+            codes.emplace(static_cast<uint8_t>(symbol), code_to_string(symbolCodes_[symbol]));
+    }
+    return codes;
+}
+
+const CodeTable& HuffmanTree::get_code_table() const {
     return symbolCodes_;
 }
 
+CodeLengths HuffmanTree::get_code_lengths() const {
+    return codeLengths_;
+}
+
+uint64_t HuffmanTree::get_compressed_bits() const {
+    return compressedBits_;
+}
+
+uint64_t HuffmanTree::get_unlimited_compressed_bits() const {
+    return unlimitedCompressedBits_;
+}
+
 } // namespace huffman
\ No newline at end of file
@@ -4,22 +4,31 @@ namespace huffman {
 
 namespace {
 
-uint8_t convert_string_to_byte(const std::string &str) {
-    uint8_t result = 0;
-    for (size_t i = 0; i < str.size(); ++i) {
-        if (str[i] != '0' && str[i] != '1')
-            throw HuffmanException("String in convert_string_to_byte must be from 0 and 1");
+// The interleaved format splits data into streams of this many symbols, the last one may be shorter
+size_t stream_length(size_t total, size_t streams) {
+    return (total + streams - 1) / streams;
+}
 
-        result |= (str[i] - '0') << (7 - i);
-    }
-    return result;
+// Also codes the token ids, they are 16-bit as well
+using WideCodec = HuffmanCodec<uint16_t, WIDE_MAX_CODE_LENGTH, uint64_t, WIDE_TABLE_BITS>;
+static_assert(WideCodec::PADDING <= DECODER_PADDING, "Payloads are read with the decoder padding");
+
+// Symbols of the 16-bit format
+const size_t WIDE_ALPHABET_SIZE = size_t(1) << 16;
+
+size_t count_compressed_bytes(std::string_view data, const CodeLengths& lengths) {
+    size_t bits = 0;
+    for (const char c : data)
+        bits += lengths[static_cast<uint8_t>(c)];
+    return (bits + 7) / 8;
 }
 
 } // anonymous namespace
 
 // HuffmanArchive helper methods
 
-HuffmanArchive::HuffmanArchive(std::string& input, std::string& output) : IArchivatorAlgorithm(input, output) {}
+HuffmanArchive::HuffmanArchive(std::string& input, std::string& output, const ArchiveOptions& options)
+    : IArchivatorAlgorithm(input, output), options_(options) {}
 
 void HuffmanArchive::open_streams() {
     input_stream_.open(input_path_, std::ios::binary);
@@ -55,22 +64,74 @@ size_t HuffmanArchive::write_to_file(T& data) {
 ArchiveInfo HuffmanArchive::compress() {
     open_streams();
 
-    std::string buffer;
-    std::map<uint8_t, size_t> freq_map;
-    char c;
-    while (input_stream_.get(c)) {
-        freq_map[static_cast<uint8_t>(c)]++;
-        buffer += c;
+    // The whole input in one read, the decoder padding after it is not used here
+    const std::vector<uint8_t> input = read_payload();
+    const std::string_view buffer(reinterpret_cast<const char*>(input.data()), input.size() - DECODER_PADDING);
+    if (options_.format == ArchiveFormat::Wide16 || options_.format == ArchiveFormat::Tokens) {
+        const ArchiveInfo stats = options_.format == ArchiveFormat::Wide16 ? compress_wide(input, buffer.size())
+                                                                           : compress_tokens(buffer);
+        close_streams();
+        return stats;
     }
 
-    HuffmanTree huffmanTree(freq_map);
-    auto codes = huffmanTree.get_codes();
+    const bool sampled = options_.sampling.mode != SamplingMode::None;
+    const Histogram histogram = sampled ? sample_bytes(input.data(), buffer.size(), options_.sampling)
+                                        : count_bytes_parallel(input.data(), buffer.size(), options_.threads);
+
+    const bool legacy = options_.format == ArchiveFormat::Legacy;
+    HuffmanTree huffmanTree(histogram, legacy ? CodeAssignment::TreeShape : CodeAssignment::Canonical,
+                            options_.max_code_length);
+    const CodeTable& codes = huffmanTree.get_code_table();
+    const std::shared_ptr<const IEncoder> encoder = options_.cache_tables
+        ? CodeCache::global().encoder(codes, options_.encoder, buffer.size())
+        : make_encoder(options_.encoder, codes, buffer.size());
 
     ArchiveInfo stats{0, 0, 0};
 
     stats.original_size = buffer.size();
-    stats.extra_size = write_meta(buffer.size(), codes);
-    stats.compressed_size = write_compressed_data(buffer, codes);
+    if (legacy) {
+        auto code_strings = huffmanTree.get_codes();
+        stats.extra_size = write_meta(buffer.size(), code_strings);
+    } else {
+        stats.extra_size = write_lengths_meta(buffer.size(), huffmanTree.get_code_lengths());
+    }
+
+    // Every stream starts from a new byte, so the exact payload size is known before encoding
+    std::vector<std::string_view> streams;
+    std::vector<size_t> stream_sizes;
+    if (options_.format == ArchiveFormat::Interleaved) {
+        if (options_.streams == 0 || options_.streams > MAX_STREAMS)
+            throw HuffmanException("Streams count must be from 1 to " + std::to_string(MAX_STREAMS));
+
+        const size_t length = stream_length(buffer.size(), options_.streams);
+        for (size_t i = 0; i < options_.streams; ++i) {
+            const size_t begin = std::min(i * length, buffer.size());
+            streams.push_back(buffer.substr(begin, length));
+            stream_sizes.push_back(count_compressed_bytes(streams.back(), huffmanTree.get_code_lengths()));
+        }
+        stats.extra_size += write_stream_sizes(stream_sizes);
+    } else if (sampled) {
+        // Sampled counts don't give the exact size, so the only stream is written as it is encoded
+        streams.push_back(buffer);
+    } else {
+        streams.push_back(buffer);
+        stream_sizes.push_back((huffmanTree.get_compressed_bits() + 7) / 8);
+    }
+
+    if (stream_sizes.empty()) {
+        stats.compressed_size = write_streamed_data(buffer, *encoder);
+    } else {
+        for (const size_t size : stream_sizes)
+            stats.compressed_size += size;
+        write_compressed_data(streams, stream_sizes, stats.compressed_size, *encoder, huffmanTree.get_code_lengths());
+    }
+
+    if (sampled && options_.sampling.measure_loss) {
+        const HuffmanTree exact(count_bytes_parallel(input.data(), buffer.size(), options_.threads),
+                                CodeAssignment::Canonical, options_.max_code_length);
+        for (const std::string_view stream : streams)
+            stats.exact_compressed_size += count_compressed_bytes(stream, exact.get_code_lengths());
+    }
 
     close_streams();
 
@@ -80,14 +141,33 @@ ArchiveInfo HuffmanArchive::compress() {
 ArchiveInfo HuffmanArchive::decompress() {
     open_streams();
     
-    std::map<std::string, uint8_t> symbols;
+    CodeTable codes{};
+    std::vector<size_t> stream_sizes;
     size_t orig_size_from_meta;
 
     ArchiveInfo stats{0, 0, 0};
 
-    stats.extra_size = read_meta(orig_size_from_meta, symbols);
+    ArchiveFormat format = ArchiveFormat::Legacy;
+    stats.extra_size = read_meta(orig_size_from_meta, format, codes, stream_sizes);
     stats.original_size = orig_size_from_meta;
-    stats.compressed_size = read_compressed_data(orig_size_from_meta, symbols);
+    if (format == ArchiveFormat::Wide16) {
+        std::vector<uint8_t> lengths;
+        stats.extra_size += read_wide_lengths(lengths);
+        uint8_t last_byte = 0;
+        if (orig_size_from_meta % 2 != 0)
+            stats.extra_size += read_from_file(last_byte);
+        stats.compressed_size = read_wide_data(orig_size_from_meta, lengths, last_byte);
+    } else if (format == ArchiveFormat::Tokens) {
+        std::vector<std::string> words;
+        stats.extra_size += read_token_dictionary(words);
+        size_t tokens_count = 0;
+        stats.extra_size += read_from_file(tokens_count);
+        std::vector<uint8_t> lengths;
+        stats.extra_size += read_wide_lengths(lengths);
+        stats.compressed_size = read_token_data(orig_size_from_meta, words, tokens_count, lengths);
+    } else {
+        stats.compressed_size = read_compressed_data(orig_size_from_meta, codes, stream_sizes);
+    }
 
     close_streams();
 
@@ -115,92 +195,435 @@ size_t HuffmanArchive::write_meta(size_t bytes_count, std::map<uint8_t, std::str
     return extra_size;
 }
 
-size_t HuffmanArchive::read_meta(size_t& result_file_size, std::map<std::string, uint8_t> &symbols) {
+size_t HuffmanArchive::write_lengths_meta(size_t bytes_count, const CodeLengths& lengths) {
+    size_t extra_size = 0;
+
+    extra_size += write_to_file(bytes_count);
+
+    size_t format_tag = FORMAT_TAG | static_cast<size_t>(options_.format);
+    extra_size += write_to_file(format_tag);
+
+    uint16_t symbols_count = 0;
+    for (const uint8_t length : lengths)
+        symbols_count += length != 0;
+    extra_size += write_to_file(symbols_count);
+
+    // Sparse alphabets are cheaper as (symbol, length) pairs, dense ones as a plain length array
+    if (symbols_count <= lengths.size() / 2) {
+        for (size_t symbol = 0; symbol < lengths.size(); ++symbol) {
+            if (lengths[symbol] == 0)
+                continue;
+            uint8_t byte = static_cast<uint8_t>(symbol);
+            extra_size += write_to_file(byte);
+            extra_size += write_to_file(lengths[symbol]);
+        }
+    } else {
+        for (const uint8_t& length : lengths)
+            extra_size += write_to_file(length);
+    }
+
+    return extra_size;
+}
+
+size_t HuffmanArchive::write_stream_sizes(const std::vector<size_t>& stream_sizes) {
+    size_t extra_size = 0;
+
+    uint8_t streams_count = static_cast<uint8_t>(stream_sizes.size());
+    extra_size += write_to_file(streams_count);
+    for (const size_t& size : stream_sizes)
+        extra_size += write_to_file(size);
+
+    return extra_size;
+}
+
+size_t HuffmanArchive::read_meta(size_t& result_file_size, ArchiveFormat& format, CodeTable& codes,
+                                 std::vector<size_t>& stream_sizes) {
     size_t extra_size = 0;
     
     extra_size += read_from_file(result_file_size);
 
     size_t codes_count = 0;
     extra_size += read_from_file(codes_count);
+    if (codes_count <= codes.size()) {
+        format = ArchiveFormat::Legacy;
+        return extra_size + read_code_strings(codes_count, codes);
+    }
+
+    if ((codes_count & ~size_t(0xFF)) != FORMAT_TAG)
+        throw HuffmanException("Unknown archive format");
+
+    format = static_cast<ArchiveFormat>(codes_count & 0xFF);
+    switch (format) {
+    case ArchiveFormat::Wide16:
+    case ArchiveFormat::Tokens:
+        // Their codes don't fit a byte code table, the caller reads them
+        return extra_size;
+    case ArchiveFormat::Canonical:
+        return extra_size + read_code_lengths(codes);
+    case ArchiveFormat::Interleaved:
+        extra_size += read_code_lengths(codes);
+        return extra_size + read_stream_sizes(stream_sizes);
+    default:
+        throw HuffmanException("Unknown archive format");
+    }
+}
+
+size_t HuffmanArchive::read_code_strings(size_t codes_count, CodeTable& codes) {
+    size_t extra_size = 0;
 
     for (size_t i = 0; i < codes_count; ++i) {
         uint8_t byte;
         extra_size += read_from_file(byte);
         size_t value_size;
         extra_size += read_from_file(value_size);
+        if (value_size > MAX_CODE_LENGTH)
+            throw HuffmanException("Code length in meta is too big");
+        if (codes[byte].length != 0)
+            throw HuffmanException("Symbol is duplicated in meta");
 
-        std::string value = "";
-        for (size_t i = 0; i < value_size; ++i)
-            value += input_stream_.get();
+        std::string value(value_size, '0');
+        input_stream_.read(value.data(), value_size);
+        if (!input_stream_)
+            throw HuffmanException("Failed to read from file");
 
-        symbols.emplace(value, byte);
+        codes[byte] = make_code_word(value);
         extra_size += value_size;
     }
 
     return extra_size;
 }
 
-size_t HuffmanArchive::write_compressed_data(std::string& buffer, std::map<uint8_t, std::string>& codes) {
-    size_t compressed_size = 0;
-    std::bitset<8> current_byte_bits;
-    size_t bits_written = 0;
+size_t HuffmanArchive::read_code_lengths(CodeTable& codes) {
+    size_t extra_size = 0;
+    CodeLengths lengths{};
+
+    uint16_t symbols_count = 0;
+    extra_size += read_from_file(symbols_count);
+    if (symbols_count > lengths.size())
+        throw HuffmanException("Codes count in meta is too big");
+
+    if (symbols_count <= lengths.size() / 2) {
+        for (size_t i = 0; i < symbols_count; ++i) {
+            uint8_t byte;
+            extra_size += read_from_file(byte);
+            if (lengths[byte] != 0)
+                throw HuffmanException("Symbol is duplicated in meta");
+            extra_size += read_from_file(lengths[byte]);
+            if (lengths[byte] == 0)
+                throw HuffmanException("Code length in meta is invalid");
+        }
+    } else {
+        for (uint8_t& length : lengths)
+            extra_size += read_from_file(length);
+    }
 
-    for (const char c : buffer) {
-        std::string& code = codes.at(static_cast<uint8_t>(c));
+    codes = make_canonical_codes(lengths);
+    return extra_size;
+}
+
+size_t HuffmanArchive::read_stream_sizes(std::vector<size_t>& stream_sizes) {
+    size_t extra_size = 0;
 
-        for (const char bit : code) {
-            if (bit == '1')
-                current_byte_bits.set(7 - bits_written);
+    uint8_t streams_count = 0;
+    extra_size += read_from_file(streams_count);
+    if (streams_count == 0)
+        throw HuffmanException("Streams count in meta must be positive");
+
+    stream_sizes.resize(streams_count);
+    for (size_t& size : stream_sizes)
+        extra_size += read_from_file(size);
+
+    return extra_size;
+}
 
-            if (++bits_written == 8) {
-                // Convert and write full byte
-                const uint8_t byte = static_cast<uint8_t>(current_byte_bits.to_ulong());
-                compressed_size += write_to_file(byte);
-                
-                // Reset for next byte
-                current_byte_bits.reset();
-                bits_written = 0;
-            }
+void HuffmanArchive::write_compressed_data(const std::vector<std::string_view>& streams,
+                                           const std::vector<size_t>& stream_sizes, size_t compressed_size,
+                                           const IEncoder& encoder, const CodeLengths& lengths) {
+    // Streams are encoded one after another into a single buffer of the exact size and written at once
+    std::vector<uint8_t> payload(compressed_size + BIT_WRITER_PADDING);
+    size_t offset = 0;
+    for (size_t i = 0; i < streams.size(); ++i) {
+        if (options_.threads > 1) {
+            encode_parallel(encoder, lengths, streams[i], payload.data() + offset, stream_sizes[i], options_.threads);
+        } else {
+            BitWriter writer(payload.data() + offset, stream_sizes[i]);
+            encoder.encode(streams[i], writer);
+            if (writer.finish() != stream_sizes[i])
+                throw HuffmanException("Compressed data is smaller than expected");
         }
+        offset += stream_sizes[i];
     }
 
-    // Write remaining bits if any
-    if (bits_written > 0) {
-        const uint8_t byte = static_cast<uint8_t>(current_byte_bits.to_ulong());
-        compressed_size += write_to_file(byte);
+    output_stream_.write(reinterpret_cast<const char*>(payload.data()), static_cast<std::streamsize>(compressed_size));
+    if (!output_stream_)
+        throw HuffmanException("Failed to write in file");
+}
+
+size_t HuffmanArchive::write_streamed_data(std::string_view data, const IEncoder& encoder) {
+    BitWriter writer(output_stream_);
+    encoder.encode(data, writer);
+    return writer.finish();
+}
+
+size_t HuffmanArchive::read_compressed_data(size_t expected_orig_size, const CodeTable& codes,
+                                            const std::vector<size_t>& stream_sizes) {
+    std::vector<uint8_t> payload = read_payload();
+    const size_t compressed_size = payload.size() - DECODER_PADDING;
+
+    // Every symbol takes at least one bit, so a bigger size means corrupted meta
+    if (expected_orig_size > compressed_size * 8)
+        throw HuffmanException("Decompressed size doesn't match expected size from meta");
+
+    std::vector<uint8_t> result(expected_orig_size);
+    const std::shared_ptr<const IDecoder> decoder = options_.cache_tables
+        ? CodeCache::global().decoder(codes, options_.decoder)
+        : make_decoder(options_.decoder, codes);
+
+    if (stream_sizes.empty()) {
+        decoder->decode(payload.data(), compressed_size, result.data(), result.size());
+    } else {
+        // Streams lie one after another, so a stream's overread lands in the next one or in the padding
+        std::vector<DecodeStream> streams;
+        const size_t length = stream_length(result.size(), stream_sizes.size());
+        size_t offset = 0;
+        for (size_t i = 0; i < stream_sizes.size(); ++i) {
+            if (stream_sizes[i] > compressed_size - offset)
+                throw HuffmanException("Stream sizes don't match compressed data");
+
+            const size_t begin = std::min(i * length, result.size());
+            const size_t count = std::min(length, result.size() - begin);
+            streams.push_back(DecodeStream{payload.data() + offset, stream_sizes[i], result.data() + begin, count});
+            offset += stream_sizes[i];
+        }
+        if (offset != compressed_size)
+            throw HuffmanException("Stream sizes don't match compressed data");
+
+        decoder->decode_streams(streams);
     }
 
+    output_stream_.write(reinterpret_cast<const char*>(result.data()), result.size());
+    if (!output_stream_)
+        throw HuffmanException("Failed to write in file");
+
     return compressed_size;
 }
 
-size_t HuffmanArchive::read_compressed_data(size_t expected_orig_size, std::map<std::string, uint8_t>& symbols) {
-    size_t compressed_size = 0;
-    char cur_byte;
-    std::string cur_code;
+ArchiveInfo HuffmanArchive::compress_wide(const std::vector<uint8_t>& input, size_t size) {
+    // Little-endian whatever the host is, like PCM and UTF-16LE
+    std::vector<uint16_t> symbols(size / 2);
+    for (size_t i = 0; i < symbols.size(); ++i)
+        symbols[i] = static_cast<uint16_t>(input[2 * i] | (input[2 * i + 1] << 8));
+    const WideCodec codec(WideCodec::count(symbols.data(), symbols.size()));
+
+    ArchiveInfo stats{size, 0, 0};
+    stats.extra_size += write_to_file(size);
+    size_t format_tag = FORMAT_TAG | static_cast<size_t>(ArchiveFormat::Wide16);
+    stats.extra_size += write_to_file(format_tag);
+    stats.extra_size += write_wide_lengths(codec.code_lengths());
+    if (size % 2 != 0) {
+        uint8_t last_byte = input[size - 1];
+        stats.extra_size += write_to_file(last_byte);
+    }
+
+    const std::vector<uint8_t> payload = codec.encode(symbols.data(), symbols.size());
+    output_stream_.write(reinterpret_cast<const char*>(payload.data()), static_cast<std::streamsize>(payload.size()));
+    if (!output_stream_)
+        throw HuffmanException("Failed to write in file");
+    stats.compressed_size = payload.size();
+
+    return stats;
+}
+
+size_t HuffmanArchive::write_wide_lengths(const std::vector<uint8_t>& lengths) {
+    size_t extra_size = 0;
+
+    uint32_t symbols_count = 0;
+    for (const uint8_t length : lengths)
+        symbols_count += length != 0;
+    extra_size += write_to_file(symbols_count);
+
+    // Sparse alphabets are cheaper as (symbol, length) pairs, dense ones as a plain length array
+    if (symbols_count <= WIDE_ALPHABET_SIZE / 3) {
+        for (size_t symbol = 0; symbol < lengths.size(); ++symbol) {
+            if (lengths[symbol] == 0)
+                continue;
+            uint16_t value = static_cast<uint16_t>(symbol);
+            extra_size += write_to_file(value);
+            extra_size += write_to_file(lengths[symbol]);
+        }
+    } else {
+        std::vector<uint8_t> dense(lengths);
+        dense.resize(WIDE_ALPHABET_SIZE, 0);
+        output_stream_.write(reinterpret_cast<const char*>(dense.data()), static_cast<std::streamsize>(dense.size()));
+        if (!output_stream_)
+            throw HuffmanException("Failed to write in file");
+        extra_size += dense.size();
+    }
 
-    while (input_stream_.get(cur_byte)) {
-        compressed_size++;
+    return extra_size;
+}
 
-        for (int i = 7; i >= 0; --i) {
-            bool cur_bit = (1 << i) & cur_byte;
-            cur_code += (cur_bit ? '1' : '0');
+size_t HuffmanArchive::read_wide_lengths(std::vector<uint8_t>& lengths) {
+    size_t extra_size = 0;
 
-            if (symbols.find(cur_code) != symbols.end() && expected_orig_size > 0) {
-                expected_orig_size -= write_to_file(symbols[cur_code]);
-                cur_code = "";
-            }
+    uint32_t symbols_count = 0;
+    extra_size += read_from_file(symbols_count);
+    if (symbols_count > WIDE_ALPHABET_SIZE)
+        throw HuffmanException("Codes count in meta is too big");
+
+    if (symbols_count <= WIDE_ALPHABET_SIZE / 3) {
+        lengths.clear();
+        for (size_t i = 0; i < symbols_count; ++i) {
+            uint16_t symbol;
+            extra_size += read_from_file(symbol);
+            if (symbol >= lengths.size())
+                lengths.resize(size_t(symbol) + 1, 0);
+            if (lengths[symbol] != 0)
+                throw HuffmanException("Symbol is duplicated in meta");
+            extra_size += read_from_file(lengths[symbol]);
+            if (lengths[symbol] == 0)
+                throw HuffmanException("Code length in meta is invalid");
         }
+    } else {
+        lengths.assign(WIDE_ALPHABET_SIZE, 0);
+        input_stream_.read(reinterpret_cast<char*>(lengths.data()), static_cast<std::streamsize>(lengths.size()));
+        if (!input_stream_)
+            throw HuffmanException("Failed to read from file");
+        extra_size += lengths.size();
     }
 
-    if (expected_orig_size != 0) {
+    return extra_size;
+}
+
+size_t HuffmanArchive::read_wide_data(size_t expected_orig_size, const std::vector<uint8_t>& lengths,
+                                      uint8_t last_byte) {
+    const WideCodec codec = WideCodec::from_lengths(lengths);
+    std::vector<uint8_t> payload = read_payload();
+    const size_t compressed_size = payload.size() - DECODER_PADDING;
+
+    // Every symbol takes at least one bit, so a bigger size means corrupted meta
+    std::vector<uint16_t> symbols(expected_orig_size / 2);
+    if (symbols.size() > compressed_size * 8)
         throw HuffmanException("Decompressed size doesn't match expected size from meta");
+    codec.decode(payload.data(), compressed_size, symbols.data(), symbols.size());
+
+    std::vector<uint8_t> result(expected_orig_size);
+    for (size_t i = 0; i < symbols.size(); ++i) {
+        result[2 * i] = static_cast<uint8_t>(symbols[i]);
+        result[2 * i + 1] = static_cast<uint8_t>(symbols[i] >> 8);
     }
+    if (expected_orig_size % 2 != 0)
+        result.back() = last_byte;
 
-    if (cur_code.size() >= 8 && convert_string_to_byte(cur_code) != 0) {
-        throw HuffmanException("Trailing bits are not zero-padded correctly");
+    output_stream_.write(reinterpret_cast<const char*>(result.data()), result.size());
+    if (!output_stream_)
+        throw HuffmanException("Failed to write in file");
+
+    return compressed_size;
+}
+
+ArchiveInfo HuffmanArchive::compress_tokens(std::string_view data) {
+    const Tokenization tokens = tokenize(data);
+    const WideCodec codec(WideCodec::count(tokens.ids.data(), tokens.ids.size()));
+
+    ArchiveInfo stats{data.size(), 0, 0};
+    stats.extra_size += write_to_file(stats.original_size);
+    size_t format_tag = FORMAT_TAG | static_cast<size_t>(ArchiveFormat::Tokens);
+    stats.extra_size += write_to_file(format_tag);
+    stats.extra_size += write_token_dictionary(tokens.words);
+    size_t tokens_count = tokens.ids.size();
+    stats.extra_size += write_to_file(tokens_count);
+    stats.extra_size += write_wide_lengths(codec.code_lengths());
+
+    const std::vector<uint8_t> payload = codec.encode(tokens.ids.data(), tokens.ids.size());
+    output_stream_.write(reinterpret_cast<const char*>(payload.data()), static_cast<std::streamsize>(payload.size()));
+    if (!output_stream_)
+        throw HuffmanException("Failed to write in file");
+    stats.compressed_size = payload.size();
+
+    return stats;
+}
+
+size_t HuffmanArchive::write_token_dictionary(const std::vector<std::string_view>& words) {
+    size_t extra_size = 0;
+
+    uint32_t words_count = static_cast<uint32_t>(words.size());
+    extra_size += write_to_file(words_count);
+    for (const std::string_view word : words) {
+        uint8_t length = static_cast<uint8_t>(word.size());
+        extra_size += write_to_file(length);
+        output_stream_.write(word.data(), static_cast<std::streamsize>(word.size()));
+        extra_size += word.size();
     }
+    if (!output_stream_)
+        throw HuffmanException("Failed to write in file");
+
+    return extra_size;
+}
+
+size_t HuffmanArchive::read_token_dictionary(std::vector<std::string>& words) {
+    size_t extra_size = 0;
+
+    uint32_t words_count = 0;
+    extra_size += read_from_file(words_count);
+    if (words_count > TOKEN_ALPHABET_SIZE - TOKEN_BYTE_IDS)
+        throw HuffmanException("Token dictionary in meta is too big");
+
+    words.resize(words_count);
+    for (std::string& word : words) {
+        uint8_t length = 0;
+        extra_size += read_from_file(length);
+        if (length == 0)
+            throw HuffmanException("Token length in meta is invalid");
+        word.resize(length);
+        input_stream_.read(word.data(), length);
+        if (!input_stream_)
+            throw HuffmanException("Failed to read from file");
+        extra_size += length;
+    }
+
+    return extra_size;
+}
+
+size_t HuffmanArchive::read_token_data(size_t expected_orig_size, const std::vector<std::string>& words,
+                                       size_t tokens_count, const std::vector<uint8_t>& lengths) {
+    const TokenTable table(std::vector<std::string_view>(words.begin(), words.end()));
+    const WideCodec codec = WideCodec::from_lengths(lengths);
+    std::vector<uint8_t> payload = read_payload();
+    const size_t compressed_size = payload.size() - DECODER_PADDING;
+
+    // Every token takes at least one bit and one byte
+    if (tokens_count > compressed_size * 8 || tokens_count > expected_orig_size)
+        throw HuffmanException("Decompressed size doesn't match expected size from meta");
+    std::vector<uint16_t> ids(tokens_count);
+    codec.decode(payload.data(), compressed_size, ids.data(), ids.size());
+
+    std::vector<uint8_t> result(expected_orig_size + TOKEN_PADDING);
+    if (table.expand(ids.data(), ids.size(), result.data(), expected_orig_size) != expected_orig_size)
+        throw HuffmanException("Decompressed size doesn't match expected size from meta");
+
+    output_stream_.write(reinterpret_cast<const char*>(result.data()), static_cast<std::streamsize>(expected_orig_size));
+    if (!output_stream_)
+        throw HuffmanException("Failed to write in file");
 
     return compressed_size;
 }
 
+std::vector<uint8_t> HuffmanArchive::read_payload() {
+    const std::streampos begin = input_stream_.tellg();
+    input_stream_.seekg(0, std::ios::end);
+    const std::streampos end = input_stream_.tellg();
+    input_stream_.seekg(begin);
+    if (!input_stream_ || end < begin)
+        throw HuffmanException("Failed to read from file");
+
+    const size_t size = static_cast<size_t>(end - begin);
+    std::vector<uint8_t> payload(size + DECODER_PADDING, 0);
+    input_stream_.read(reinterpret_cast<char*>(payload.data()), size);
+    if (!input_stream_)
+        throw HuffmanException("Failed to read from file");
+
+    return payload;
+}
+
 } // namespace huffman
\ No newline at end of file
@@ -0,0 +1,562 @@
+#include "huffman_decoder.hpp"
+#include <algorithm>
+#include <map>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HUFFMAN_HAS_AVX2_KERNEL 1
+#endif
+
+namespace huffman {
+
+namespace {
+
+struct StreamCursor {
+    BitReader reader;
+    uint8_t* out;
+    size_t left;
+};
+
+// Decodes the rest of the stream symbol by symbol
+template<typename Decoder>
+void finish_stream(const Decoder& decoder, StreamCursor& cursor) {
+    const size_t lookahead = decoder.lookahead();
+    for (; cursor.left != 0; --cursor.left) {
+        if (cursor.reader.available() < lookahead)
+            cursor.reader.refill();
+        cursor.reader.consume(decoder.decode_symbol(cursor.reader.peek(), *cursor.out++));
+    }
+
+    if (cursor.reader.overrun())
+        throw HuffmanException("Decompressed size doesn't match expected size from meta");
+}
+
+// Makes a step in each of `Ways` streams per iteration while all of them have room for a whole step.
+// The streams don't depend on each other, so their lookups overlap in the CPU pipeline.
+template<typename Decoder, size_t Ways>
+void decode_group(const Decoder& decoder, StreamCursor* cursors) {
+    const size_t lookahead = decoder.lookahead();
+
+    for (;;) {
+        bool ready = true;
+#pragma GCC unroll 8
+        for (size_t i = 0; i < Ways; ++i)
+            ready &= cursors[i].left >= Decoder::STEP_SYMBOLS;
+        if (!ready)
+            break;
+
+#pragma GCC unroll 8
+        for (size_t i = 0; i < Ways; ++i) {
+            StreamCursor& cursor = cursors[i];
+            if (cursor.reader.available() < lookahead)
+                cursor.reader.refill();
+
+            size_t length;
+            const size_t produced = decoder.step(cursor.reader.peek(), cursor.out, length);
+            cursor.reader.consume(length);
+            cursor.out += produced;
+            cursor.left -= produced;
+        }
+    }
+
+    for (size_t i = 0; i < Ways; ++i)
+        finish_stream(decoder, cursors[i]);
+}
+
+template<typename Decoder>
+void decode_single(const Decoder& decoder, const uint8_t* data, size_t size, uint8_t* out, size_t count) {
+    StreamCursor cursor{BitReader(data, size), out, count};
+    decode_group<Decoder, 1>(decoder, &cursor);
+}
+
+template<typename Decoder>
+void decode_interleaved(const Decoder& decoder, const std::vector<DecodeStream>& streams) {
+    std::vector<StreamCursor> cursors;
+    for (const DecodeStream& stream : streams)
+        cursors.push_back(StreamCursor{BitReader(stream.data, stream.size), stream.out, stream.count});
+
+    size_t i = 0;
+    for (; i + INTERLEAVE_WAYS <= cursors.size(); i += INTERLEAVE_WAYS) {
+        // Local copies let the compiler keep the cursors in registers
+        StreamCursor group[INTERLEAVE_WAYS] = {cursors[i], cursors[i + 1], cursors[i + 2], cursors[i + 3]};
+        decode_group<Decoder, INTERLEAVE_WAYS>(decoder, group);
+    }
+    for (; i < cursors.size(); ++i)
+        decode_group<Decoder, 1>(decoder, &cursors[i]);
+}
+
+// Gather offsets are 32-bit, so the streams of a group must lie within this many bytes
+const size_t MAX_GATHER_SPAN = size_t(1) << 28;
+
+#ifdef HUFFMAN_HAS_AVX2_KERNEL
+
+// Makes `steps` steps in each of the 8 streams starting at the given bit positions relative to `base`.
+// Reads are clamped to one byte past `limits`, so a corrupted stream stops there and overruns.
+// Returns false if a code is missing from the table.
+__attribute__((target("avx2")))
+bool gather_steps(const uint16_t* table, size_t table_bits, const uint8_t* base,
+                  uint32_t* positions, const uint32_t* limits, uint8_t* const* outs, size_t steps) {
+    const __m256i bswap = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+                                           3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    const __m128i index_shift = _mm_cvtsi32_si128(static_cast<int>(32 - table_bits));
+    const __m256i byte_mask = _mm256_set1_epi32(0xFF);
+    const __m256i bit_mask = _mm256_set1_epi32(7);
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i byte_limits = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(limits));
+    const __m256i bit_limits = _mm256_slli_epi32(_mm256_add_epi32(byte_limits, _mm256_set1_epi32(1)), 3);
+
+    __m256i position = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(positions));
+    __m256i invalid = zero;
+    alignas(32) uint32_t entries[GatherDecoder::WAYS];
+
+    for (size_t step = 0; step < steps; ++step) {
+        const __m256i bytes = _mm256_min_epu32(_mm256_srli_epi32(position, 3), byte_limits);
+        __m256i window = _mm256_i32gather_epi32(reinterpret_cast<const int*>(base), bytes, 1);
+        window = _mm256_sllv_epi32(_mm256_shuffle_epi8(window, bswap), _mm256_and_si256(position, bit_mask));
+
+        const __m256i index = _mm256_srl_epi32(window, index_shift);
+        const __m256i entry = _mm256_i32gather_epi32(reinterpret_cast<const int*>(table), index, 2);
+        const __m256i length = _mm256_and_si256(_mm256_srli_epi32(entry, 8), byte_mask);
+
+        invalid = _mm256_or_si256(invalid, _mm256_cmpeq_epi32(length, zero));
+        position = _mm256_min_epu32(_mm256_add_epi32(position, length), bit_limits);
+
+        _mm256_store_si256(reinterpret_cast<__m256i*>(entries), entry);
+#pragma GCC unroll 8
+        for (size_t i = 0; i < GatherDecoder::WAYS; ++i)
+            outs[i][step] = static_cast<uint8_t>(entries[i]);
+    }
+
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(positions), position);
+    return _mm256_testz_si256(invalid, invalid);
+}
+
+#endif
+
+} // anonymous namespace
+
+// TableDecoder
+
+TableDecoder::TableDecoder(const CodeTable& codes, size_t table_bits)
+    : table_bits_(table_bits), max_length_(0) {
+    if (table_bits == 0 || table_bits > MAX_TABLE_BITS)
+        throw HuffmanException("Decode table bits must be from 1 to " + std::to_string(MAX_TABLE_BITS));
+    check_prefix_free(codes);
+
+    table_.assign(size_t(1) << table_bits_, Entry{0, 0});
+    for (size_t symbol = 0; symbol < codes.size(); ++symbol) {
+        const CodeWord& code = codes[symbol];
+        if (code.length == 0)
+            continue;
+        max_length_ = std::max<size_t>(max_length_, code.length);
+
+        if (code.length > table_bits_) {
+            long_codes_.push_back(LongCode{code.bits, code.length, static_cast<uint8_t>(symbol)});
+            continue;
+        }
+
+        // Every index starting with the code maps to the symbol
+        const size_t first = code.bits << (table_bits_ - code.length);
+        const size_t last = first + (size_t(1) << (table_bits_ - code.length));
+        std::fill(table_.begin() + first, table_.begin() + last,
+                  Entry{static_cast<uint8_t>(symbol), code.length});
+    }
+
+    std::sort(long_codes_.begin(), long_codes_.end(), [](const LongCode& left, const LongCode& right) {
+        return left.length < right.length;
+    });
+}
+
+const TableDecoder::LongCode& TableDecoder::find_long_code(uint64_t window) const {
+    for (const LongCode& code : long_codes_) {
+        if ((window >> (64 - code.length)) == code.bits)
+            return code;
+    }
+    throw HuffmanException("Invalid code in compressed data");
+}
+
+void TableDecoder::decode(const uint8_t* data, size_t size, uint8_t* out, size_t count) const {
+    decode_single(*this, data, size, out, count);
+}
+
+void TableDecoder::decode_streams(const std::vector<DecodeStream>& streams) const {
+    decode_interleaved(*this, streams);
+}
+
+// CanonicalDecoder
+
+CanonicalDecoder::CanonicalDecoder(const CodeTable& codes) : max_length_(0) {
+    check_prefix_free(codes);
+    if (!is_canonical(codes))
+        throw HuffmanException("Canonical decoder needs canonical codes");
+
+    std::array<size_t, MAX_CODE_LENGTH + 1> length_count{};
+    for (const CodeWord& code : codes) {
+        if (code.length == 0)
+            continue;
+        length_count[code.length]++;
+        max_length_ = std::max<size_t>(max_length_, code.length);
+    }
+
+    std::array<uint64_t, MAX_CODE_LENGTH + 1> first_code{};
+    std::array<size_t, MAX_CODE_LENGTH + 1> first_index{};
+    for (size_t length = 1, index = 0; length <= MAX_CODE_LENGTH; ++length) {
+        first_index[length] = index;
+        index += length_count[length];
+    }
+    symbols_.resize(first_index[MAX_CODE_LENGTH] + length_count[MAX_CODE_LENGTH]);
+
+    // Canonical codes of one length go in symbol order, so the smallest one comes first
+    for (size_t symbol = codes.size(); symbol-- > 0;) {
+        const CodeWord& code = codes[symbol];
+        if (code.length != 0)
+            first_code[code.length] = code.bits;
+    }
+    for (size_t symbol = 0; symbol < codes.size(); ++symbol) {
+        const CodeWord& code = codes[symbol];
+        if (code.length != 0)
+            symbols_[first_index[code.length] + (code.bits - first_code[code.length])] = static_cast<uint8_t>(symbol);
+    }
+
+    for (size_t length = 1; length <= MAX_CODE_LENGTH; ++length) {
+        if (length_count[length] == 0) {
+            // No codes of this length: the window never stops here
+            end_code_[length] = length > 1 ? end_code_[length - 1] << 1 : 0;
+            continue;
+        }
+        end_code_[length] = first_code[length] + length_count[length];
+        offset_[length] = first_index[length] - first_code[length];
+    }
+
+    // Windows grow with the code length, so the smallest window with k leading ones bounds the length
+    for (size_t ones = 0; ones < start_length_.size(); ++ones) {
+        const uint64_t window = ones == 0 ? 0 : ~uint64_t(0) << (64 - ones);
+        size_t length = 1;
+        while (length < max_length_ && (window >> (64 - length)) >= end_code_[length])
+            ++length;
+        start_length_[ones] = static_cast<uint8_t>(length);
+    }
+}
+
+void CanonicalDecoder::decode(const uint8_t* data, size_t size, uint8_t* out, size_t count) const {
+    decode_single(*this, data, size, out, count);
+}
+
+void CanonicalDecoder::decode_streams(const std::vector<DecodeStream>& streams) const {
+    decode_interleaved(*this, streams);
+}
+
+// MultiSymbolDecoder
+
+MultiSymbolDecoder::MultiSymbolDecoder(const CodeTable& codes, size_t table_bits)
+    : single_(codes, table_bits), table_bits_(table_bits), table_(size_t(1) << table_bits) {
+    for (size_t index = 0; index < table_.size(); ++index) {
+        Entry& entry = table_[index];
+        entry = Entry{{0, 0, 0, 0}, 0, 0};
+
+        // Greedily decode the index while whole codes fit into it
+        const uint64_t window = uint64_t(index) << (64 - table_bits_);
+        while (entry.count < MAX_SYMBOLS) {
+            uint8_t symbol;
+            const size_t length = single_.lookup(window << entry.length, symbol);
+            if (length == 0 || entry.length + length > table_bits_)
+                break;
+
+            entry.symbols[entry.count++] = symbol;
+            entry.length += static_cast<uint8_t>(length);
+        }
+    }
+}
+
+void MultiSymbolDecoder::decode(const uint8_t* data, size_t size, uint8_t* out, size_t count) const {
+    decode_single(*this, data, size, out, count);
+}
+
+void MultiSymbolDecoder::decode_streams(const std::vector<DecodeStream>& streams) const {
+    decode_interleaved(*this, streams);
+}
+
+// TwoLevelDecoder
+
+TwoLevelDecoder::TwoLevelDecoder(const CodeTable& codes, size_t primary_bits)
+    : primary_bits_(primary_bits), max_length_(0) {
+    if (primary_bits == 0 || primary_bits > MAX_TABLE_BITS)
+        throw HuffmanException("Decode table bits must be from 1 to " + std::to_string(MAX_TABLE_BITS));
+    check_prefix_free(codes);
+
+    std::vector<SymbolCode> symbol_codes;
+    for (size_t symbol = 0; symbol < codes.size(); ++symbol) {
+        const CodeWord& code = codes[symbol];
+        if (code.length == 0)
+            continue;
+        symbol_codes.push_back(SymbolCode{code.bits, code.length, static_cast<uint8_t>(symbol)});
+        max_length_ = std::max<size_t>(max_length_, code.length);
+    }
+
+    build_table(symbol_codes, 0, primary_bits_);
+}
+
+size_t TwoLevelDecoder::build_table(const std::vector<SymbolCode>& codes, size_t prefix_length, size_t bits) {
+    const size_t offset = entries_.size();
+    if (offset + (size_t(1) << bits) > LINK_OFFSET_MASK)
+        throw HuffmanException("Decode tables are too big");
+    entries_.resize(offset + (size_t(1) << bits), 0);
+
+    const size_t table_end = prefix_length + bits;
+    std::map<size_t, std::vector<SymbolCode>> long_codes;
+    for (const SymbolCode& code : codes) {
+        const uint64_t suffix = code.bits & ((uint64_t(1) << (code.length - prefix_length)) - 1);
+
+        if (code.length > table_end) {
+            long_codes[suffix >> (code.length - table_end)].push_back(code);
+            continue;
+        }
+
+        const size_t first = offset + (suffix << (table_end - code.length));
+        const size_t last = first + (size_t(1) << (table_end - code.length));
+        std::fill(entries_.begin() + first, entries_.begin() + last,
+                  (uint32_t(code.length) << 8) | code.symbol);
+    }
+
+    for (auto& pair : long_codes) {
+        size_t max_length = 0;
+        for (const SymbolCode& code : pair.second)
+            max_length = std::max<size_t>(max_length, code.length);
+
+        const size_t sub_bits = std::min(max_length - table_end, MAX_SUB_BITS);
+        const size_t sub_offset = build_table(pair.second, table_end, sub_bits);
+        entries_[offset + pair.first] = LINK_FLAG | (uint32_t(sub_bits) << LINK_BITS_SHIFT) | uint32_t(sub_offset);
+    }
+
+    return offset;
+}
+
+void TwoLevelDecoder::decode(const uint8_t* data, size_t size, uint8_t* out, size_t count) const {
+    decode_single(*this, data, size, out, count);
+}
+
+void TwoLevelDecoder::decode_streams(const std::vector<DecodeStream>& streams) const {
+    decode_interleaved(*this, streams);
+}
+
+// TreeDecoder
+
+TreeDecoder::TreeDecoder(const CodeTable& codes) : max_length_(0), children_(2, MISSING_CHILD) {
+    check_prefix_free(codes);
+
+    for (size_t symbol = 0; symbol < codes.size(); ++symbol) {
+        const CodeWord& code = codes[symbol];
+        if (code.length == 0)
+            continue;
+        max_length_ = std::max<size_t>(max_length_, code.length);
+
+        // Walk down the code creating missing internal nodes, prefix-freeness keeps leaves off the path
+        size_t node = 0;
+        for (size_t i = code.length - 1; i > 0; --i) {
+            const size_t index = 2 * node + ((code.bits >> i) & 1);
+            if (children_[index] == MISSING_CHILD) {
+                if (children_.size() / 2 >= LEAF_FLAG)
+                    throw HuffmanException("Decode tree is too big");
+                children_[index] = static_cast<uint16_t>(children_.size() / 2);
+                children_.resize(children_.size() + 2, MISSING_CHILD);
+            }
+            node = children_[index];
+        }
+        children_[2 * node + (code.bits & 1)] = static_cast<uint16_t>(LEAF_FLAG | symbol);
+    }
+}
+
+void TreeDecoder::decode(const uint8_t* data, size_t size, uint8_t* out, size_t count) const {
+    decode_single(*this, data, size, out, count);
+}
+
+void TreeDecoder::decode_streams(const std::vector<DecodeStream>& streams) const {
+    decode_interleaved(*this, streams);
+}
+
+// StateMachineDecoder
+
+StateMachineDecoder::StateMachineDecoder(const CodeTable& codes) {
+    const TreeDecoder tree(codes);
+    if (tree.node_count() > MAX_STATES)
+        throw HuffmanException("Code tree has too many states for the state machine decoder");
+
+    transitions_.resize(tree.node_count() * 256);
+    for (size_t state = 0; state < tree.node_count(); ++state) {
+        for (size_t byte = 0; byte < 256; ++byte) {
+            Transition& transition = transitions_[state * 256 + byte];
+            transition = Transition{{0, 0, 0, 0, 0, 0, 0, 0}, 0, 0};
+
+            size_t node = state;
+            for (size_t i = 8; i-- > 0;) {
+                const uint16_t child = tree.child(node, (byte >> i) & 1);
+                if (child == TreeDecoder::MISSING_CHILD) {
+                    node = INVALID_STATE;
+                    break;
+                }
+                if (child & TreeDecoder::LEAF_FLAG) {
+                    transition.symbols[transition.count++] = static_cast<uint8_t>(child);
+                    node = 0;
+                } else {
+                    node = child;
+                }
+            }
+            transition.next = static_cast<uint16_t>(node);
+        }
+    }
+}
+
+void StateMachineDecoder::decode(const uint8_t* data, size_t size, uint8_t* out, size_t count) const {
+    const uint8_t* const end = data + size;
+    size_t state = 0;
+
+    // A whole transition fits into the output while 8 symbols are left
+    for (; count >= 8 && data != end; ++data) {
+        const Transition& transition = transitions_[state * 256 + *data];
+        std::copy(transition.symbols, transition.symbols + 8, out);
+        if (transition.next == INVALID_STATE)
+            throw HuffmanException("Invalid code in compressed data");
+        out += transition.count;
+        count -= transition.count;
+        state = transition.next;
+    }
+
+    for (; count != 0 && data != end; ++data) {
+        const Transition& transition = transitions_[state * 256 + *data];
+        const size_t produced = std::min<size_t>(transition.count, count);
+        out = std::copy(transition.symbols, transition.symbols + produced, out);
+        count -= produced;
+        // Padding after the last symbol may leave the tree
+        if (transition.next == INVALID_STATE && count != 0)
+            throw HuffmanException("Invalid code in compressed data");
+        state = transition.next;
+    }
+
+    if (count != 0)
+        throw HuffmanException("Decompressed size doesn't match expected size from meta");
+}
+
+void StateMachineDecoder::decode_streams(const std::vector<DecodeStream>& streams) const {
+    for (const DecodeStream& stream : streams)
+        decode(stream.data, stream.size, stream.out, stream.count);
+}
+
+// GatherDecoder
+
+GatherDecoder::GatherDecoder(const CodeTable& codes) : single_(codes), table_bits_(1) {
+    for (const CodeWord& code : codes)
+        table_bits_ = std::max<size_t>(table_bits_, code.length);
+    if (table_bits_ > MAX_TABLE_BITS)
+        throw HuffmanException("Gather decoder needs codes not longer than " + std::to_string(MAX_TABLE_BITS) + " bits");
+
+    // One more entry for the 4-byte gather of the last one
+    table_.assign((size_t(1) << table_bits_) + 1, 0);
+    for (size_t symbol = 0; symbol < codes.size(); ++symbol) {
+        const CodeWord& code = codes[symbol];
+        if (code.length == 0)
+            continue;
+        const size_t first = code.bits << (table_bits_ - code.length);
+        const size_t last = first + (size_t(1) << (table_bits_ - code.length));
+        std::fill(table_.begin() + first, table_.begin() + last, static_cast<uint16_t>((code.length << 8) | symbol));
+    }
+}
+
+bool GatherDecoder::supported() {
+#ifdef HUFFMAN_HAS_AVX2_KERNEL
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    return avx2;
+#else
+    return false;
+#endif
+}
+
+void GatherDecoder::decode(const uint8_t* data, size_t size, uint8_t* out, size_t count) const {
+    single_.decode(data, size, out, count);
+}
+
+void GatherDecoder::decode_streams(const std::vector<DecodeStream>& streams) const {
+    size_t i = 0;
+    if (supported()) {
+        for (; i + WAYS <= streams.size(); i += WAYS)
+            decode_group(&streams[i]);
+    }
+    single_.decode_streams(std::vector<DecodeStream>(streams.begin() + i, streams.end()));
+}
+
+void GatherDecoder::decode_group(const DecodeStream* streams) const {
+    const uint8_t* base = streams[0].data;
+    const uint8_t* end = streams[0].data + streams[0].size;
+    size_t steps = streams[0].count;
+    for (size_t i = 1; i < WAYS; ++i) {
+        base = std::min(base, streams[i].data);
+        end = std::max(end, streams[i].data + streams[i].size);
+        steps = std::min(steps, streams[i].count);
+    }
+
+    uint32_t positions[WAYS];
+    uint32_t limits[WAYS];
+    uint8_t* outs[WAYS];
+    for (size_t i = 0; i < WAYS; ++i) {
+        positions[i] = static_cast<uint32_t>((streams[i].data - base) * 8);
+        limits[i] = static_cast<uint32_t>(streams[i].data - base + streams[i].size);
+        outs[i] = streams[i].out;
+    }
+
+#ifdef HUFFMAN_HAS_AVX2_KERNEL
+    if (static_cast<size_t>(end - base) < MAX_GATHER_SPAN) {
+        if (!gather_steps(table_.data(), table_bits_, base, positions, limits, outs, steps))
+            throw HuffmanException("Invalid code in compressed data");
+    } else {
+        steps = 0;
+    }
+#else
+    steps = 0;
+#endif
+
+    // The shorter last stream and the tails of the others go symbol by symbol
+    for (size_t i = 0; i < WAYS; ++i) {
+        const size_t position = positions[i] - static_cast<size_t>(streams[i].data - base) * 8;
+        const size_t byte = position >> 3;
+        if (byte > streams[i].size)
+            throw HuffmanException("Decompressed size doesn't match expected size from meta");
+
+        StreamCursor cursor{BitReader(streams[i].data + byte, streams[i].size - byte),
+                            streams[i].out + steps, streams[i].count - steps};
+        cursor.reader.consume(position & 7);
+        finish_stream(single_, cursor);
+    }
+}
+
+std::unique_ptr<IDecoder> make_decoder(DecoderType type, const CodeTable& codes) {
+    switch (type) {
+    case DecoderType::TwoLevel:
+        return std::make_unique<TwoLevelDecoder>(codes);
+    case DecoderType::Canonical:
+        return std::make_unique<CanonicalDecoder>(codes);
+    case DecoderType::MultiSymbol:
+        return std::make_unique<MultiSymbolDecoder>(codes);
+    case DecoderType::Tree:
+        return std::make_unique<TreeDecoder>(codes);
+    case DecoderType::StateMachine:
+        return std::make_unique<StateMachineDecoder>(codes);
+    case DecoderType::Gather:
+        return std::make_unique<GatherDecoder>(codes);
+    case DecoderType::Auto: {
+        // Codes longer than the flat table go to sub-tables instead of its slow path
+        uint8_t max_length = 0;
+        for (const CodeWord& code : codes)
+            max_length = std::max(max_length, code.length);
+        if (max_length > DEFAULT_TABLE_BITS)
+            return std::make_unique<TwoLevelDecoder>(codes);
+        // Takes over groups of interleaved streams, the rest still goes to the table decoder
+        if (GatherDecoder::supported())
+            return std::make_unique<GatherDecoder>(codes);
+        break;
+    }
+    case DecoderType::Table:
+        break;
+    }
+    return std::make_unique<TableDecoder>(codes);
+}
+
+} // namespace huffman
@@ -0,0 +1,279 @@
+#include "huffman_encoder.hpp"
+#include <algorithm>
+#include <exception>
+#include <thread>
+
+namespace huffman {
+
+namespace {
+
+// Input bytes packed between writes to the BitWriter
+const size_t BATCH_BLOCK_SIZE = size_t(1) << 14;
+
+// Packer state: pending bits at the top of `word`, less than 8 of them between calls
+struct PackState {
+    uint64_t word;
+    size_t filled;
+};
+
+// Adds `Group` codes to the word and stores its whole bytes. Their lengths must add up to at most 56.
+template<size_t Group>
+__attribute__((always_inline)) inline uint8_t* pack_group(const uint64_t* bits, const uint8_t* lengths,
+                                                         PackState& state, uint8_t* out) {
+    size_t end = state.filled;
+#pragma GCC unroll 8
+    for (size_t k = 0; k < Group; ++k) {
+        end += lengths[k];
+        state.word |= bits[k] << (64 - end);
+    }
+
+    store_big_endian64(out, state.word);
+    state.word <<= end & ~size_t(7);
+    state.filled = end & 7;
+    return out + (end >> 3);
+}
+
+template<size_t Group>
+__attribute__((always_inline)) inline uint8_t* pack_codes(const uint64_t* code_bits, const uint8_t* code_lengths,
+                                                         const uint8_t* data, size_t size,
+                                                         PackState& state, uint8_t* out) {
+    uint64_t bits[BatchEncoder::BATCH];
+    uint8_t lengths[BatchEncoder::BATCH];
+    // A local copy stays in registers, the output stores could alias the caller's one
+    PackState local = state;
+
+    size_t i = 0;
+    for (; i + BatchEncoder::BATCH <= size; i += BatchEncoder::BATCH) {
+#pragma GCC unroll 8
+        for (size_t k = 0; k < BatchEncoder::BATCH; ++k) {
+            bits[k] = code_bits[data[i + k]];
+            lengths[k] = code_lengths[data[i + k]];
+        }
+#pragma GCC unroll 8
+        for (size_t k = 0; k < BatchEncoder::BATCH; k += Group)
+            out = pack_group<Group>(bits + k, lengths + k, local, out);
+    }
+
+    for (; i < size; ++i)
+        out = pack_group<1>(&code_bits[data[i]], &code_lengths[data[i]], local, out);
+
+    state = local;
+    return out;
+}
+
+uint8_t* pack_codes_generic(const uint64_t* bits, const uint8_t* lengths, size_t group,
+                            const uint8_t* data, size_t size, PackState& state, uint8_t* out) {
+    switch (group) {
+    case 8:
+        return pack_codes<8>(bits, lengths, data, size, state, out);
+    case 4:
+        return pack_codes<4>(bits, lengths, data, size, state, out);
+    case 2:
+        return pack_codes<2>(bits, lengths, data, size, state, out);
+    default:
+        return pack_codes<1>(bits, lengths, data, size, state, out);
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HUFFMAN_HAS_BMI2_KERNEL 1
+
+// The same code, but variable shifts become shlx and don't touch flags
+__attribute__((target("bmi2")))
+uint8_t* pack_codes_bmi2(const uint64_t* bits, const uint8_t* lengths, size_t group,
+                         const uint8_t* data, size_t size, PackState& state, uint8_t* out) {
+    switch (group) {
+    case 8:
+        return pack_codes<8>(bits, lengths, data, size, state, out);
+    case 4:
+        return pack_codes<4>(bits, lengths, data, size, state, out);
+    case 2:
+        return pack_codes<2>(bits, lengths, data, size, state, out);
+    default:
+        return pack_codes<1>(bits, lengths, data, size, state, out);
+    }
+}
+#endif
+
+} // anonymous namespace
+
+// SymbolEncoder
+
+SymbolEncoder::SymbolEncoder(const CodeTable& codes) : codes_(codes) {}
+
+void SymbolEncoder::encode(std::string_view data, BitWriter& writer) const {
+    for (const char c : data) {
+        const CodeWord& code = codes_[static_cast<uint8_t>(c)];
+        writer.write(code.bits, code.length);
+    }
+}
+
+// PairEncoder
+
+PairEncoder::PairEncoder(const CodeTable& codes) : codes_(codes), pairs_(size_t(1) << 16, 0) {
+    for (size_t first = 0; first < codes.size(); ++first) {
+        for (size_t second = 0; second < codes.size(); ++second) {
+            const size_t length = codes[first].length + codes[second].length;
+            if (codes[first].length == 0 || codes[second].length == 0 || length > MAX_BITS)
+                continue;
+
+            const uint64_t bits = (codes[first].bits << codes[second].length) | codes[second].bits;
+            pairs_[(first << 8) | second] = static_cast<uint32_t>((bits << 8) | length);
+        }
+    }
+}
+
+void PairEncoder::encode(std::string_view data, BitWriter& writer) const {
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data.data());
+    size_t i = 0;
+    for (; i + 2 <= data.size(); i += 2) {
+        const uint32_t pair = pairs_[(size_t(bytes[i]) << 8) | bytes[i + 1]];
+        if (pair != 0) {
+            writer.write(pair >> 8, pair & 0xFF);
+            continue;
+        }
+
+        writer.write(codes_[bytes[i]].bits, codes_[bytes[i]].length);
+        writer.write(codes_[bytes[i + 1]].bits, codes_[bytes[i + 1]].length);
+    }
+
+    // The odd last byte
+    if (i < data.size())
+        writer.write(codes_[bytes[i]].bits, codes_[bytes[i]].length);
+}
+
+// BatchEncoder
+
+BatchEncoder::BatchEncoder(const CodeTable& codes) {
+    size_t max_length = 1;
+    for (size_t symbol = 0; symbol < codes.size(); ++symbol) {
+        bits_[symbol] = codes[symbol].bits;
+        lengths_[symbol] = codes[symbol].length;
+        max_length = std::max<size_t>(max_length, codes[symbol].length);
+    }
+
+    // 7 pending bits and a group of codes must fit into the 64-bit word
+    group_ = 1;
+    while (group_ * 2 <= BATCH && group_ * 2 * max_length <= 56)
+        group_ *= 2;
+}
+
+bool BatchEncoder::bmi2_supported() {
+#ifdef HUFFMAN_HAS_BMI2_KERNEL
+    static const bool bmi2 = __builtin_cpu_supports("bmi2");
+    return bmi2;
+#else
+    return false;
+#endif
+}
+
+void BatchEncoder::encode(std::string_view data, BitWriter& writer) const {
+    auto pack = pack_codes_generic;
+#ifdef HUFFMAN_HAS_BMI2_KERNEL
+    if (bmi2_supported())
+        pack = pack_codes_bmi2;
+#endif
+
+    // Every code takes at most MAX_CODE_LENGTH bits and the last store spills a whole word
+    std::vector<uint8_t> block(BATCH_BLOCK_SIZE * MAX_CODE_LENGTH / 8 + sizeof(uint64_t));
+    PackState state{0, 0};
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data.data());
+    for (size_t begin = 0; begin < data.size(); begin += BATCH_BLOCK_SIZE) {
+        const size_t size = std::min(BATCH_BLOCK_SIZE, data.size() - begin);
+        const uint8_t* end = pack(bits_.data(), lengths_.data(), group_, bytes + begin, size, state, block.data());
+        writer.write_bytes(block.data(), static_cast<size_t>(end - block.data()));
+    }
+
+    if (state.filled != 0)
+        writer.write(state.word >> (64 - state.filled), state.filled);
+}
+
+void encode_parallel(const IEncoder& encoder, const CodeLengths& lengths, std::string_view data,
+                     uint8_t* out, size_t size, size_t threads) {
+    const size_t chunks = std::max<size_t>(1, std::min(threads, data.size() / PARALLEL_MIN_CHUNK));
+    const size_t chunk_length = (data.size() + chunks - 1) / chunks;
+    auto chunk = [&](size_t i) {
+        return data.substr(std::min(i * chunk_length, data.size()), chunk_length);
+    };
+
+    auto run = [chunks](auto&& job) {
+        std::vector<std::thread> workers;
+        for (size_t i = 1; i < chunks; ++i)
+            workers.emplace_back(job, i);
+        job(0);
+        for (std::thread& worker : workers)
+            worker.join();
+    };
+
+    std::vector<size_t> offsets(chunks + 1, 0);
+    run([&](size_t i) {
+        size_t bits = 0;
+        for (const char c : chunk(i))
+            bits += lengths[static_cast<uint8_t>(c)];
+        offsets[i + 1] = bits;
+    });
+    for (size_t i = 0; i < chunks; ++i)
+        offsets[i + 1] += offsets[i];
+    if ((offsets[chunks] + 7) / 8 != size)
+        throw HuffmanException("Compressed data size doesn't match the codes");
+
+    // A chunk owns its bytes after the first one, the first one may be shared with the previous chunk
+    std::vector<uint8_t> first_bytes(chunks, 0);
+    std::vector<std::exception_ptr> errors(chunks);
+    run([&](size_t i) {
+        try {
+            const size_t shift = offsets[i] % 8;
+            const size_t bytes = (shift + offsets[i + 1] - offsets[i] + 7) / 8;
+            if (bytes == 0)
+                return;
+
+            std::vector<uint8_t> buffer(bytes + BIT_WRITER_PADDING);
+            BitWriter writer(buffer.data(), bytes);
+            if (shift != 0)
+                writer.write(0, shift);
+            encoder.encode(chunk(i), writer);
+            writer.finish();
+
+            first_bytes[i] = buffer[0];
+            std::copy(buffer.begin() + 1, buffer.begin() + bytes, out + offsets[i] / 8 + 1);
+        } catch (...) {
+            errors[i] = std::current_exception();
+        }
+    });
+    for (const std::exception_ptr& error : errors) {
+        if (error)
+            std::rethrow_exception(error);
+    }
+
+    // In order, so a shared byte already holds the previous chunks' bits
+    for (size_t i = 0; i < chunks; ++i) {
+        if (offsets[i + 1] == offsets[i])
+            continue;
+        if (offsets[i] % 8 == 0)
+            out[offsets[i] / 8] = first_bytes[i];
+        else
+            out[offsets[i] / 8] |= first_bytes[i];
+    }
+}
+
+EncoderType resolve_encoder_type(EncoderType type, size_t data_size) {
+    if (type != EncoderType::Auto)
+        return type;
+    // The batch kernel needs no big table and packs up to 8 codes per store
+    return data_size >= BatchEncoder::BATCH ? EncoderType::Batch : EncoderType::Symbol;
+}
+
+std::unique_ptr<IEncoder> make_encoder(EncoderType type, const CodeTable& codes, size_t data_size) {
+    switch (resolve_encoder_type(type, data_size)) {
+    case EncoderType::Pair:
+        return std::make_unique<PairEncoder>(codes);
+    case EncoderType::Symbol:
+        return std::make_unique<SymbolEncoder>(codes);
+    case EncoderType::Auto:
+    case EncoderType::Batch:
+        break;
+    }
+    return std::make_unique<BatchEncoder>(codes);
+}
+
+} // namespace huffman
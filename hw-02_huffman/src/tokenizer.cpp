@@ -0,0 +1,121 @@
+#include "tokenizer.hpp"
+#include "huffman_exception.hpp"
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <string>
+
+namespace huffman {
+
+namespace {
+
+// Twice the largest dictionary, so probe chains stay short
+const size_t TOKEN_HASH_SLOTS = TOKEN_ALPHABET_SIZE * 2;
+
+constexpr std::array<bool, 256> make_word_bytes() {
+    std::array<bool, 256> result{};
+    for (size_t byte = 0; byte < result.size(); ++byte) {
+        result[byte] = (byte >= 'a' && byte <= 'z') || (byte >= 'A' && byte <= 'Z') ||
+                       (byte >= '0' && byte <= '9') || byte == '_' || byte >= 0x80;
+    }
+    return result;
+}
+
+constexpr std::array<bool, 256> WORD_BYTES = make_word_bytes();
+
+// FNV-1a, computed while the run is scanned
+const uint32_t HASH_BASIS = 2166136261u;
+const uint32_t HASH_PRIME = 16777619u;
+
+struct Slot {
+    uint32_t hash;
+    // Word index plus one, zero marks a free slot
+    uint32_t word;
+};
+
+} // anonymous namespace
+
+Tokenization tokenize(std::string_view data) {
+    Tokenization result;
+    result.ids.reserve(data.size() / 4);
+
+    // Open addressing, the full hash is kept so other words rarely need a comparison
+    std::vector<Slot> slots(TOKEN_HASH_SLOTS, Slot{0, 0});
+    const size_t max_words = TOKEN_ALPHABET_SIZE - TOKEN_BYTE_IDS;
+
+    size_t begin = 0;
+    while (begin < data.size()) {
+        const bool word = WORD_BYTES[static_cast<uint8_t>(data[begin])];
+        uint32_t hash = (HASH_BASIS ^ static_cast<uint8_t>(data[begin])) * HASH_PRIME;
+        size_t end = begin + 1;
+        const size_t limit = std::min(data.size(), begin + MAX_TOKEN_LENGTH);
+        for (; end < limit && WORD_BYTES[static_cast<uint8_t>(data[end])] == word; ++end)
+            hash = (hash ^ static_cast<uint8_t>(data[end])) * HASH_PRIME;
+
+        const std::string_view token = data.substr(begin, end - begin);
+        begin = end;
+        if (token.size() == 1) {
+            result.ids.push_back(static_cast<uint8_t>(token[0]));
+            continue;
+        }
+
+        size_t index = hash & (TOKEN_HASH_SLOTS - 1);
+        while (slots[index].word != 0 && (slots[index].hash != hash || result.words[slots[index].word - 1] != token))
+            index = (index + 1) & (TOKEN_HASH_SLOTS - 1);
+
+        Slot& slot = slots[index];
+        if (slot.word == 0) {
+            if (result.words.size() == max_words) {
+                // The dictionary is full, new words go byte by byte
+                for (const char c : token)
+                    result.ids.push_back(static_cast<uint8_t>(c));
+                continue;
+            }
+            result.words.push_back(token);
+            slot = Slot{hash, static_cast<uint32_t>(result.words.size())};
+        }
+        result.ids.push_back(static_cast<uint16_t>(TOKEN_BYTE_IDS + slot.word - 1));
+    }
+
+    return result;
+}
+
+// TokenTable
+
+TokenTable::TokenTable(const std::vector<std::string_view>& words) {
+    if (words.size() > TOKEN_ALPHABET_SIZE - TOKEN_BYTE_IDS)
+        throw HuffmanException("Token dictionary is too big");
+
+    for (size_t byte = 0; byte < TOKEN_BYTE_IDS; ++byte) {
+        entries_.push_back(Entry{static_cast<uint32_t>(bytes_.size()), 1});
+        bytes_.push_back(static_cast<uint8_t>(byte));
+    }
+    for (const std::string_view word : words) {
+        if (word.empty() || word.size() > MAX_TOKEN_LENGTH)
+            throw HuffmanException("Token length must be from 1 to " + std::to_string(MAX_TOKEN_LENGTH));
+        entries_.push_back(Entry{static_cast<uint32_t>(bytes_.size()), static_cast<uint32_t>(word.size())});
+        bytes_.insert(bytes_.end(), word.begin(), word.end());
+    }
+    bytes_.resize(bytes_.size() + TOKEN_PADDING, 0);
+}
+
+size_t TokenTable::expand(const uint16_t* ids, size_t count, uint8_t* out, size_t size) const {
+    size_t position = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (ids[i] >= entries_.size())
+            throw HuffmanException("Token id is out of the dictionary");
+        const Entry& entry = entries_[ids[i]];
+        if (entry.length > size - position)
+            throw HuffmanException("Decompressed size doesn't match expected size from meta");
+
+        // Most tokens are short: one fixed 16-byte move, the padding takes what is past the token
+        if (entry.length <= TOKEN_PADDING)
+            std::memcpy(out + position, bytes_.data() + entry.offset, TOKEN_PADDING);
+        else
+            std::memcpy(out + position, bytes_.data() + entry.offset, entry.length);
+        position += entry.length;
+    }
+    return position;
+}
+
+} // namespace huffman
@@ -1,6 +1,16 @@
 #define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "bit_reader.hpp"
+#include "bit_writer.hpp"
+#include "code_cache.hpp"
+#include "code_lengths.hpp"
+#include "histogram.hpp"
 #include "huffman.hpp"
 #include "huffman_archive.hpp"
+#include "huffman_codec.hpp"
+#include "huffman_decoder.hpp"
+#include "huffman_encoder.hpp"
+#include "static_codec.hpp"
+#include "tokenizer.hpp"
 #include <doctest/doctest.h>
 #include <map>
 #include <cstdint>
@@ -48,6 +58,13 @@ TEST_SUITE("HuffmanTree") {
 
             CHECK(codes.at('F').length() < codes.at('A').length());
             CHECK(codes.at('E').length() < codes.at('B').length());
+
+            const CodeTable& table = tree.get_code_table();
+            for (const auto& pair : codes) {
+                CHECK(table[pair.first].length == pair.second.size());
+                CHECK(code_to_string(table[pair.first]) == pair.second);
+            }
+            CHECK(table['Z'].length == 0);
         }
     }
     
@@ -90,6 +107,129 @@ TEST_SUITE("HuffmanTree") {
         }
     }
     
+    TEST_CASE("HuffmanTree canonical codes") {
+        std::map<uint8_t, size_t> freqMap = {
+            {'A', 5},
+            {'B', 9},
+            {'C', 12},
+            {'D', 13},
+            {'E', 16},
+            {'F', 45}
+        };
+        HuffmanTree tree(freqMap, CodeAssignment::Canonical);
+        auto codes = tree.get_codes();
+        auto lengths = tree.get_code_lengths();
+
+        CHECK(codes.at('F') == "0");
+        CHECK(codes.at('C') == "100");
+        CHECK(codes.at('D') == "101");
+        CHECK(codes.at('E') == "110");
+        CHECK(codes.at('A') == "1110");
+        CHECK(codes.at('B') == "1111");
+        CHECK(lengths['A'] == 4);
+        CHECK(lengths['Z'] == 0);
+
+        CHECK(is_canonical(make_code_table(codes)));
+        CHECK(make_code_table(codes)['B'].bits == make_canonical_codes(lengths)['B'].bits);
+
+        CodeLengths oversubscribed{};
+        oversubscribed['a'] = oversubscribed['b'] = oversubscribed['c'] = 1;
+        CHECK_THROWS_AS(make_canonical_codes(oversubscribed), HuffmanException);
+    }
+
+    TEST_CASE("HuffmanTree length-limited codes") {
+        // Fibonacci frequencies give the deepest tree possible
+        std::map<uint8_t, size_t> freqMap;
+        size_t previous = 1, current = 1;
+        for (int symbol = 0; symbol < 30; ++symbol) {
+            freqMap[static_cast<uint8_t>(symbol)] = current;
+            size_t next = previous + current;
+            previous = current;
+            current = next;
+        }
+
+        HuffmanTree unlimited(freqMap);
+        CHECK(unlimited.get_compressed_bits() == unlimited.get_unlimited_compressed_bits());
+
+        for (size_t limit : {5, 11, 12, 15}) {
+            HuffmanTree tree(freqMap, CodeAssignment::TreeShape, limit);
+            auto lengths = tree.get_code_lengths();
+
+            double kraft = 0;
+            for (size_t symbol = 0; symbol < 30; ++symbol) {
+                CHECK(lengths[symbol] >= 1);
+                CHECK(lengths[symbol] <= limit);
+                kraft += 1.0 / double(uint64_t(1) << lengths[symbol]);
+            }
+            CHECK(kraft == doctest::Approx(1.0));
+
+            CHECK(is_canonical(make_code_table(tree.get_codes())));
+            CHECK(tree.get_unlimited_compressed_bits() == unlimited.get_compressed_bits());
+            CHECK(tree.get_compressed_bits() > tree.get_unlimited_compressed_bits());
+        }
+
+        SUBCASE("Loose limit keeps Huffman lengths") {
+            std::vector<uint64_t> freqs = {5, 9, 12, 13, 16, 45};
+            CHECK(limited_code_lengths(freqs, 15) == std::vector<uint8_t>{4, 4, 3, 3, 3, 1});
+            CHECK(limited_code_lengths(freqs, 3) == std::vector<uint8_t>{3, 3, 3, 3, 2, 2});
+            CHECK(limited_code_lengths({7}, 1) == std::vector<uint8_t>{1});
+        }
+
+        SUBCASE("Impossible limits") {
+            CHECK_THROWS_AS(HuffmanTree(freqMap, CodeAssignment::TreeShape, 4), HuffmanException);
+            CHECK_THROWS_AS(HuffmanTree(freqMap, CodeAssignment::TreeShape, 0), HuffmanException);
+            CHECK_THROWS_AS(HuffmanTree(freqMap, CodeAssignment::TreeShape, MAX_CODE_LENGTH + 1), HuffmanException);
+        }
+    }
+
+    TEST_CASE("In-place code lengths") {
+        constexpr Histogram histogram = [] {
+            Histogram counts{};
+            counts['A'] = 5;
+            counts['B'] = 9;
+            counts['C'] = 12;
+            counts['D'] = 13;
+            counts['E'] = 16;
+            counts['F'] = 45;
+            return counts;
+        }();
+        constexpr CodeLengths lengths = huffman_code_lengths(histogram);
+        static_assert(lengths['A'] == 4 && lengths['B'] == 4 && lengths['F'] == 1, "computed at compile time");
+        CHECK(lengths == HuffmanTree(histogram).get_code_lengths());
+
+        CHECK(huffman_code_lengths(Histogram{}) == CodeLengths{});
+        Histogram single{};
+        single['x'] = 1000;
+        CHECK(huffman_code_lengths(single)['x'] == 1);
+
+        // Ties may give other lengths than the merge tree, but never a longer encoding
+        uint32_t state = 5;
+        for (size_t round = 0; round < 200; ++round) {
+            CAPTURE(round);
+            Histogram counts{};
+            const size_t symbols = round % 2 == 0 ? 256 : 2 + round;
+            for (size_t symbol = 0; symbol < symbols; ++symbol) {
+                state = state * 1103515245 + 12345;
+                // Small counts make ties, huge ones exercise the upper radix passes
+                counts[symbol] = round % 3 == 0 ? (state >> 28) : uint64_t(state) << (round % 16);
+            }
+
+            const CodeLengths computed = huffman_code_lengths(counts);
+            const HuffmanTree tree(counts, CodeAssignment::TreeShape);
+            uint64_t bits = 0;
+            double kraft = 0;
+            for (size_t symbol = 0; symbol < counts.size(); ++symbol) {
+                CHECK((computed[symbol] == 0) == (counts[symbol] == 0));
+                bits += counts[symbol] * computed[symbol];
+                if (computed[symbol] != 0)
+                    kraft += 1.0 / double(uint64_t(1) << computed[symbol]);
+            }
+            CHECK(bits == tree.get_unlimited_compressed_bits());
+            if (tree.get_codes().size() > 1)
+                CHECK(kraft == doctest::Approx(1.0));
+        }
+    }
+
     TEST_CASE("HuffmanTree edge cases") {
         
         SUBCASE("All symbols have same frequency") {
@@ -133,6 +273,837 @@ TEST_SUITE("HuffmanTree") {
 }
 
 
+TEST_SUITE("Histogram") {
+
+    TEST_CASE("Histogram kernel counts every byte") {
+        std::vector<uint8_t> data;
+        uint32_t state = 7;
+        for (size_t i = 0; i < 10000; ++i) {
+            state = state * 1103515245 + 12345;
+            // Long runs of one value next to random bytes
+            data.push_back(i % 1000 < 300 ? 'r' : static_cast<uint8_t>(state >> 24));
+        }
+
+        for (size_t size : {0, 1, 7, 8, 9, 63, 10000}) {
+            CAPTURE(size);
+            Histogram expected{};
+            for (size_t i = 0; i < size; ++i)
+                expected[data[i]]++;
+            CHECK(count_bytes(data.data(), size) == expected);
+        }
+    }
+
+    TEST_CASE("Parallel histogram matches one thread") {
+        std::vector<uint8_t> data(3 * HISTOGRAM_MIN_CHUNK + 12345);
+        uint32_t state = 1;
+        for (uint8_t& byte : data) {
+            state = state * 1103515245 + 12345;
+            byte = static_cast<uint8_t>(state >> 27);
+        }
+
+        const Histogram expected = count_bytes(data.data(), data.size());
+        for (size_t threads : {0, 1, 2, 3, 4, 16}) {
+            CAPTURE(threads);
+            CHECK(count_bytes_parallel(data.data(), data.size(), threads) == expected);
+        }
+        CHECK(count_bytes_parallel(data.data(), 0, 4) == Histogram{});
+    }
+
+    TEST_CASE("Sampled histogram covers every byte value") {
+        std::vector<uint8_t> data(100000);
+        for (size_t i = 0; i < data.size(); ++i)
+            data[i] = static_cast<uint8_t>('a' + i % 7);
+
+        SamplingOptions options;
+        options.block_size = 1000;
+        options.stride = 10;
+
+        for (SamplingMode mode : {SamplingMode::Strided, SamplingMode::Random}) {
+            CAPTURE(static_cast<int>(mode));
+            options.mode = mode;
+            const Histogram histogram = sample_bytes(data.data(), data.size(), options);
+            for (size_t value = 0; value < histogram.size(); ++value)
+                CHECK(histogram[value] >= 1);
+            // 1000 is not a multiple of 7, the samples see each letter about equally
+            for (char c = 'a'; c < 'a' + 7; ++c)
+                CHECK(histogram[static_cast<uint8_t>(c)] == doctest::Approx(data.size() / 7.0).epsilon(0.01));
+            CHECK(sample_bytes(data.data(), data.size(), options) == histogram);
+        }
+
+        // Counting every block only adds the floor
+        options.mode = SamplingMode::Strided;
+        options.stride = 1;
+        Histogram expected = count_bytes(data.data(), data.size());
+        for (uint64_t& count : expected)
+            count = std::max<uint64_t>(count, 1);
+        CHECK(sample_bytes(data.data(), data.size(), options) == expected);
+
+        options.stride = 0;
+        CHECK_THROWS_AS(sample_bytes(data.data(), data.size(), options), HuffmanException);
+        options = SamplingOptions();
+        CHECK_THROWS_AS(sample_bytes(data.data(), data.size(), options), HuffmanException);
+    }
+
+    TEST_CASE("HuffmanTree from a histogram") {
+        std::map<uint8_t, size_t> freqMap = {{'A', 5}, {'B', 9}, {'C', 12}, {'D', 13}, {'E', 16}, {'F', 45}};
+        Histogram histogram{};
+        for (const auto& pair : freqMap)
+            histogram[pair.first] = pair.second;
+
+        for (CodeAssignment assignment : {CodeAssignment::TreeShape, CodeAssignment::Canonical}) {
+            HuffmanTree from_map(freqMap, assignment);
+            HuffmanTree from_histogram(histogram, assignment);
+            CHECK(from_map.get_codes() == from_histogram.get_codes());
+            CHECK(from_map.get_compressed_bits() == from_histogram.get_compressed_bits());
+        }
+
+        CHECK(HuffmanTree(Histogram{}).get_codes().empty());
+    }
+}
+
+
+TEST_SUITE("BitReader") {
+
+    TEST_CASE("BitReader reads MSB first") {
+        std::vector<uint8_t> data = {0b10110010, 0xFF, 0x00, 0x5A, 0xC3, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66};
+        const size_t size = data.size();
+        data.resize(size + BIT_READER_PADDING, 0);
+        BitReader reader(data.data(), size);
+
+        CHECK(reader.available() >= BIT_READER_MIN_AVAILABLE);
+        CHECK(reader.peek(3) == 0b101);
+        CHECK(reader.read(1) == 1);
+        CHECK(reader.read(4) == 0b0110);
+        CHECK(reader.read(11) == 0b01011111111);
+        CHECK(reader.read(16) == 0x005A);
+        CHECK(reader.read(40) == 0xC311223344);
+        CHECK(reader.position() == 72);
+        CHECK(reader.read(16) == 0x5566);
+        CHECK_FALSE(reader.overrun());
+
+        CHECK(reader.read(8) == 0);
+        CHECK(reader.overrun());
+    }
+
+    TEST_CASE("BitReader stays inside the padding") {
+        std::vector<uint8_t> data(1 + BIT_READER_PADDING, 0);
+        data[0] = 0xFF;
+        BitReader reader(data.data(), 1);
+
+        for (int i = 0; i < 100; ++i)
+            reader.read(50);
+        CHECK(reader.overrun());
+    }
+}
+
+
+TEST_SUITE("BitWriter") {
+
+    TEST_CASE("BitWriter writes MSB first") {
+        std::ostringstream sink;
+        BitWriter writer(sink);
+        writer.write(0b1, 1);
+        writer.write(0b0110, 4);
+        writer.write(0b01011111111, 11);
+        writer.write(0x005A, 16);
+        writer.write(0xC311223344, 40);
+        writer.write(0b101, 3);
+        CHECK(writer.finish() == 10);
+
+        const std::string expected = {'\xB2', '\xFF', '\x00', '\x5A', '\xC3', '\x11', '\x22', '\x33', '\x44', '\xA0'};
+        CHECK(sink.str() == expected);
+    }
+
+    TEST_CASE("BitWriter and BitReader round trip") {
+        // A tiny buffer makes the writer flush many times
+        std::ostringstream sink;
+        BitWriter writer(sink, 16);
+        std::vector<std::pair<uint64_t, size_t>> codes;
+        uint64_t state = 12345;
+        size_t total_bits = 0;
+        for (int i = 0; i < 1000; ++i) {
+            state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+            const size_t count = 1 + (state >> 58) % BIT_WRITER_MAX_BITS;
+            const uint64_t bits = (state >> 3) & ((uint64_t(1) << count) - 1);
+            codes.emplace_back(bits, count);
+            writer.write(bits, count);
+            total_bits += count;
+        }
+        CHECK(writer.finish() == (total_bits + 7) / 8);
+
+        std::string data = sink.str();
+        data.resize(data.size() + BIT_READER_PADDING, '\0');
+        BitReader reader(reinterpret_cast<const uint8_t*>(data.data()), data.size() - BIT_READER_PADDING);
+        for (const auto& code : codes)
+            CHECK(reader.read(code.second) == code.first);
+        CHECK_FALSE(reader.overrun());
+    }
+
+    TEST_CASE("BitWriter into memory of exact size") {
+        std::vector<uint8_t> data(5 + BIT_WRITER_PADDING, 0);
+        BitWriter writer(data.data(), 5);
+        writer.write(0xABCDEF, 24);
+        writer.write_bytes(reinterpret_cast<const uint8_t*>("\x12"), 1);
+        writer.write(0b101, 3);
+        CHECK(writer.finish() == 5);
+        CHECK(data[0] == 0xAB);
+        CHECK(data[3] == 0x12);
+        CHECK(data[4] == 0xA0);
+
+        BitWriter overflow(data.data(), 2);
+        overflow.write(0xABCDEF, 24);
+        CHECK_THROWS_AS(overflow.finish(), HuffmanException);
+
+        BitWriter long_overflow(data.data(), 3);
+        CHECK_THROWS_AS(long_overflow.write(0xFFFFFFFFFF, 40), HuffmanException);
+    }
+
+    TEST_CASE("BitWriter empty output") {
+        std::ostringstream sink;
+        BitWriter writer(sink);
+        CHECK(writer.finish() == 0);
+        CHECK(sink.str().empty());
+    }
+}
+
+
+TEST_SUITE("Decoders") {
+
+    std::vector<uint8_t> encode_with(const CodeTable& codes, const std::string& text) {
+        std::vector<uint8_t> data(DECODER_PADDING, 0);
+        size_t bit_pos = 0;
+        for (const char c : text) {
+            const CodeWord& code = codes[static_cast<uint8_t>(c)];
+            for (int i = code.length - 1; i >= 0; --i, ++bit_pos) {
+                if (bit_pos / 8 + DECODER_PADDING >= data.size())
+                    data.push_back(0);
+                if ((code.bits >> i) & 1)
+                    data[bit_pos / 8] |= 0x80 >> (bit_pos % 8);
+            }
+        }
+        return data;
+    }
+
+    std::map<uint8_t, size_t> count_text(const std::string& text) {
+        std::map<uint8_t, size_t> freq_map;
+        for (const char c : text)
+            freq_map[static_cast<uint8_t>(c)]++;
+        return freq_map;
+    }
+
+    TEST_CASE("TableDecoder round trip") {
+        const std::string text = "abracadabra, the quick brown fox jumps over the lazy dog";
+        HuffmanTree tree(count_text(text));
+        const CodeTable codes = make_code_table(tree.get_codes());
+        const std::vector<uint8_t> data = encode_with(codes, text);
+        const size_t size = data.size() - DECODER_PADDING;
+
+        for (size_t table_bits : {1, 3, 8, 11, 16}) {
+            CAPTURE(table_bits);
+            TableDecoder decoder(codes, table_bits);
+            std::string result(text.size(), '\0');
+            decoder.decode(data.data(), size, reinterpret_cast<uint8_t*>(result.data()), result.size());
+            CHECK(result == text);
+        }
+    }
+
+    TEST_CASE("Every decoder round trip") {
+        // Fibonacci frequencies give codes longer than the decode tables
+        std::string text;
+        for (size_t i = 0, a = 1, b = 1; i < 20; ++i, std::swap(a, b), b += a)
+            text += std::string(a, static_cast<char>('a' + i));
+        for (size_t i = 0; i < text.size(); i += 7)
+            std::swap(text[i], text[(i * 31) % text.size()]);
+
+        for (CodeAssignment assignment : {CodeAssignment::TreeShape, CodeAssignment::Canonical}) {
+            HuffmanTree tree(count_text(text), assignment);
+            const CodeTable codes = make_code_table(tree.get_codes());
+            const std::vector<uint8_t> data = encode_with(codes, text);
+
+            for (DecoderType type : {DecoderType::Table, DecoderType::Canonical, DecoderType::MultiSymbol,
+                                     DecoderType::TwoLevel, DecoderType::Tree, DecoderType::StateMachine}) {
+                if (type == DecoderType::Canonical && assignment != CodeAssignment::Canonical)
+                    continue;
+                CAPTURE(static_cast<int>(type));
+
+                std::unique_ptr<IDecoder> decoder = make_decoder(type, codes);
+                std::string result(text.size(), '\0');
+                decoder->decode(data.data(), data.size() - DECODER_PADDING,
+                                reinterpret_cast<uint8_t*>(result.data()), result.size());
+                CHECK(result == text);
+
+                CHECK_THROWS_AS(decoder->decode(data.data(), data.size() / 2,
+                                                reinterpret_cast<uint8_t*>(result.data()), result.size()),
+                                HuffmanException);
+            }
+        }
+    }
+
+    TEST_CASE("TwoLevelDecoder with very long codes") {
+        // Lengths 1, 2, ..., 44, 45, 45 form a complete code as deep as a Fibonacci tree
+        CodeLengths lengths{};
+        std::string text;
+        for (size_t i = 0; i < 46; ++i) {
+            lengths['0' + i] = static_cast<uint8_t>(std::min<size_t>(i + 1, 45));
+            text += std::string(3, static_cast<char>('0' + i));
+        }
+        const CodeTable codes = make_canonical_codes(lengths);
+        const std::vector<uint8_t> data = encode_with(codes, text);
+
+        for (size_t primary_bits : {1, 6, 10}) {
+            CAPTURE(primary_bits);
+            TwoLevelDecoder decoder(codes, primary_bits);
+            std::string result(text.size(), '\0');
+            decoder.decode(data.data(), data.size() - DECODER_PADDING,
+                           reinterpret_cast<uint8_t*>(result.data()), result.size());
+            CHECK(result == text);
+        }
+
+        CodeTable incomplete{};
+        incomplete['a'] = CodeWord{0b0, 1};
+        incomplete['b'] = CodeWord{0b10, 2};
+        std::vector<uint8_t> ones(1 + DECODER_PADDING, 0xFF);
+        uint8_t out;
+        CHECK_THROWS_AS(TwoLevelDecoder(incomplete).decode(ones.data(), 1, &out, 1), HuffmanException);
+    }
+
+    TEST_CASE("TreeDecoder memory and long codes") {
+        std::map<uint8_t, size_t> freqMap;
+        for (size_t symbol = 0; symbol < 256; ++symbol)
+            freqMap[static_cast<uint8_t>(symbol)] = symbol * symbol + 1;
+        HuffmanTree tree(freqMap);
+        CHECK(TreeDecoder(make_code_table(tree.get_codes())).memory_size() < 2048);
+
+        CodeLengths lengths{};
+        std::string text;
+        for (size_t i = 0; i < 46; ++i) {
+            lengths['0' + i] = static_cast<uint8_t>(std::min<size_t>(i + 1, 45));
+            text += std::string(2, static_cast<char>('0' + i));
+        }
+        const CodeTable codes = make_canonical_codes(lengths);
+        const std::vector<uint8_t> data = encode_with(codes, text);
+        std::string result(text.size(), '\0');
+        TreeDecoder(codes).decode(data.data(), data.size() - DECODER_PADDING,
+                                  reinterpret_cast<uint8_t*>(result.data()), result.size());
+        CHECK(result == text);
+
+        CodeTable incomplete{};
+        incomplete['a'] = CodeWord{0b0, 1};
+        incomplete['b'] = CodeWord{0b10, 2};
+        std::vector<uint8_t> ones(1 + DECODER_PADDING, 0xFF);
+        uint8_t out;
+        CHECK_THROWS_AS(TreeDecoder(incomplete).decode(ones.data(), 1, &out, 1), HuffmanException);
+    }
+
+    TEST_CASE("StateMachineDecoder edge cases") {
+        CodeTable single{};
+        single['z'] = CodeWord{0b0, 1};
+        std::vector<uint8_t> zeros(2 + DECODER_PADDING, 0);
+        std::string result(11, '\0');
+        StateMachineDecoder(single).decode(zeros.data(), 2, reinterpret_cast<uint8_t*>(result.data()), 11);
+        CHECK(result == std::string(11, 'z'));
+        CHECK_THROWS_AS(StateMachineDecoder(single).decode(zeros.data(), 1, reinterpret_cast<uint8_t*>(result.data()), 11),
+                        HuffmanException);
+
+        CodeTable incomplete{};
+        incomplete['a'] = CodeWord{0b0, 1};
+        incomplete['b'] = CodeWord{0b10, 2};
+        std::vector<uint8_t> data = {0b01000110, 0, 0, 0, 0, 0, 0, 0, 0};
+        uint8_t out[4];
+        StateMachineDecoder decoder(incomplete);
+        decoder.decode(data.data(), 1, out, 4);
+        CHECK(std::string(out, out + 4) == "abaa");
+        CHECK_THROWS_AS(decoder.decode(data.data(), 1, out, 5), HuffmanException);
+
+        // Sparse long codes need more states than a complete byte code
+        CodeTable sparse{};
+        for (uint64_t i = 0; i < 16; ++i)
+            sparse[i] = CodeWord{i << 52, 56};
+        CHECK_THROWS_AS(StateMachineDecoder{sparse}, HuffmanException);
+    }
+
+    TEST_CASE("Interleaved streams decoding") {
+        const std::vector<std::string> texts = {
+            "first stream", "second stream is longer", "", "x", "fifth stream after a group of four"
+        };
+        std::string all;
+        for (const std::string& text : texts)
+            all += text;
+
+        HuffmanTree tree(count_text(all), CodeAssignment::Canonical);
+        const CodeTable codes = make_code_table(tree.get_codes());
+
+        std::vector<std::vector<uint8_t>> data;
+        for (const std::string& text : texts)
+            data.push_back(encode_with(codes, text));
+
+        for (DecoderType type : {DecoderType::Table, DecoderType::Canonical, DecoderType::MultiSymbol,
+                                 DecoderType::TwoLevel, DecoderType::Tree, DecoderType::StateMachine,
+                                 DecoderType::Gather}) {
+            CAPTURE(static_cast<int>(type));
+            std::string result(all.size(), '\0');
+            std::vector<DecodeStream> streams;
+            size_t offset = 0;
+            for (size_t i = 0; i < texts.size(); ++i) {
+                uint8_t* out = reinterpret_cast<uint8_t*>(result.data()) + offset;
+                streams.push_back(DecodeStream{data[i].data(), data[i].size() - DECODER_PADDING, out, texts[i].size()});
+                offset += texts[i].size();
+            }
+
+            make_decoder(type, codes)->decode_streams(streams);
+            CHECK(result == all);
+
+            streams[1].size /= 2;
+            CHECK_THROWS_AS(make_decoder(type, codes)->decode_streams(streams), HuffmanException);
+        }
+    }
+
+    TEST_CASE("GatherDecoder groups of streams") {
+        // Nine streams in one buffer like in the archive: a group of eight, uneven lengths and a leftover
+        std::vector<std::string> texts;
+        for (size_t i = 0; i < 9; ++i) {
+            std::string text;
+            for (size_t j = 0; j < 300 + 37 * i; ++j)
+                text += static_cast<char>('a' + (j * j + i) % 13);
+            texts.push_back(text);
+        }
+        std::string all;
+        for (const std::string& text : texts)
+            all += text;
+
+        HuffmanTree tree(count_text(all));
+        const CodeTable codes = make_code_table(tree.get_codes());
+
+        std::vector<uint8_t> payload;
+        std::vector<size_t> sizes;
+        for (const std::string& text : texts) {
+            std::vector<uint8_t> data = encode_with(codes, text);
+            sizes.push_back(data.size() - DECODER_PADDING);
+            payload.insert(payload.end(), data.begin(), data.end() - DECODER_PADDING);
+        }
+        payload.resize(payload.size() + DECODER_PADDING, 0);
+
+        std::string result(all.size(), '\0');
+        std::vector<DecodeStream> streams;
+        size_t offset = 0, out_offset = 0;
+        for (size_t i = 0; i < texts.size(); ++i) {
+            streams.push_back(DecodeStream{payload.data() + offset, sizes[i],
+                                           reinterpret_cast<uint8_t*>(result.data()) + out_offset, texts[i].size()});
+            offset += sizes[i];
+            out_offset += texts[i].size();
+        }
+
+        GatherDecoder decoder(codes);
+        decoder.decode_streams(streams);
+        CHECK(result == all);
+
+        streams[3].count += 40;
+        CHECK_THROWS_AS(decoder.decode_streams(streams), HuffmanException);
+
+        CodeLengths lengths{};
+        for (size_t i = 0; i < 20; ++i)
+            lengths['a' + i] = static_cast<uint8_t>(std::min<size_t>(i + 1, 19));
+        CHECK_THROWS_AS(GatherDecoder{make_canonical_codes(lengths)}, HuffmanException);
+    }
+
+    TEST_CASE("CanonicalDecoder round trip") {
+        const std::string text = "canonical codes come from lengths alone: zzzzzzzzzzzzzzzzzzzzzzzzz";
+        HuffmanTree tree(count_text(text), CodeAssignment::Canonical);
+        const CodeTable codes = make_code_table(tree.get_codes());
+        const std::vector<uint8_t> data = encode_with(codes, text);
+
+        CanonicalDecoder decoder(codes);
+        std::string result(text.size(), '\0');
+        decoder.decode(data.data(), data.size() - DECODER_PADDING,
+                       reinterpret_cast<uint8_t*>(result.data()), result.size());
+        CHECK(result == text);
+
+        CodeTable shuffled = codes;
+        std::swap(shuffled['z'], shuffled[':']);
+        if (shuffled['z'].length == shuffled[':'].length)
+            std::swap(shuffled['c'], shuffled['a']);
+        CHECK_THROWS_AS(CanonicalDecoder{shuffled}, HuffmanException);
+    }
+
+    TEST_CASE("TableDecoder errors") {
+        SUBCASE("Codes are not prefix-free") {
+            CodeTable codes{};
+            codes['a'] = CodeWord{0b0, 1};
+            codes['b'] = CodeWord{0b01, 2};
+            CHECK_THROWS_AS(TableDecoder{codes}, HuffmanException);
+        }
+
+        SUBCASE("Data is shorter than expected") {
+            CodeTable codes{};
+            codes['a'] = CodeWord{0b0, 1};
+            codes['b'] = CodeWord{0b1, 1};
+            std::vector<uint8_t> data(1 + DECODER_PADDING, 0);
+            uint8_t out[16];
+            TableDecoder decoder(codes);
+            CHECK_NOTHROW(decoder.decode(data.data(), 1, out, 8));
+            CHECK_THROWS_AS(decoder.decode(data.data(), 1, out, 9), HuffmanException);
+        }
+    }
+}
+
+
+TEST_SUITE("Encoders") {
+
+    std::string encode_bits(const CodeTable& codes, const std::string& text) {
+        std::string result;
+        uint8_t byte = 0;
+        size_t bits = 0;
+        for (const char c : text) {
+            const CodeWord& code = codes[static_cast<uint8_t>(c)];
+            for (size_t i = code.length; i-- > 0;) {
+                byte = static_cast<uint8_t>((byte << 1) | ((code.bits >> i) & 1));
+                if (++bits % 8 == 0)
+                    result += static_cast<char>(byte);
+            }
+        }
+        if (bits % 8 != 0)
+            result += static_cast<char>(byte << (8 - bits % 8));
+        return result;
+    }
+
+    TEST_CASE("Every encoder matches bit-by-bit packing") {
+        // Fibonacci frequencies give pairs too long for the pair table next to short ones
+        std::string text;
+        for (size_t i = 0, a = 1, b = 1; i < 20; ++i, std::swap(a, b), b += a)
+            text += std::string(a, static_cast<char>('a' + i));
+        for (size_t i = 0; i < text.size(); i += 7)
+            std::swap(text[i], text[(i * 31) % text.size()]);
+
+        std::map<uint8_t, size_t> freqMap;
+        for (const char c : text)
+            freqMap[static_cast<uint8_t>(c)]++;
+        HuffmanTree tree(freqMap);
+        const CodeTable& codes = tree.get_code_table();
+
+        for (const std::string& input : {text, text.substr(1), std::string("a"), std::string()}) {
+            for (EncoderType type : {EncoderType::Auto, EncoderType::Symbol, EncoderType::Pair,
+                                     EncoderType::Batch}) {
+                CAPTURE(input.size());
+                CAPTURE(static_cast<int>(type));
+                std::ostringstream sink;
+                BitWriter writer(sink);
+                make_encoder(type, codes, input.size())->encode(input, writer);
+                const size_t written = writer.finish();
+                CHECK(written == sink.str().size());
+                CHECK(sink.str() == encode_bits(codes, input));
+            }
+        }
+    }
+
+    TEST_CASE("Parallel encoding matches one thread") {
+        // Chunks of odd bit lengths, so their boundaries fall inside bytes
+        std::string text;
+        for (size_t i = 0; text.size() < 4 * PARALLEL_MIN_CHUNK + 12345; ++i)
+            text += static_cast<char>("aaaaaaaabbbbccdefghhh"[(i * i + i / 7) % 21]);
+
+        std::map<uint8_t, size_t> freqMap;
+        for (const char c : text)
+            freqMap[static_cast<uint8_t>(c)]++;
+        HuffmanTree tree(freqMap);
+        const size_t size = (tree.get_compressed_bits() + 7) / 8;
+        auto encoder = make_encoder(EncoderType::Auto, tree.get_code_table(), text.size());
+
+        std::vector<uint8_t> expected(size + BIT_WRITER_PADDING);
+        BitWriter writer(expected.data(), size);
+        encoder->encode(text, writer);
+        CHECK(writer.finish() == size);
+
+        for (size_t threads : {1, 2, 3, 4, 7}) {
+            CAPTURE(threads);
+            std::vector<uint8_t> result(size + BIT_WRITER_PADDING, 0xFF);
+            encode_parallel(*encoder, tree.get_code_lengths(), text, result.data(), size, threads);
+            CHECK(std::equal(result.begin(), result.begin() + size, expected.begin()));
+        }
+
+        std::vector<uint8_t> small(size);
+        CHECK_THROWS_AS(encode_parallel(*encoder, tree.get_code_lengths(), text, small.data(), size - 1, 2),
+                        HuffmanException);
+    }
+}
+
+
+namespace {
+
+// Mostly lowercase letters and spaces, like protocol text with a fixed alphabet
+struct TextDistribution {
+    static constexpr Histogram counts = [] {
+        Histogram result{};
+        for (char c = 'a'; c <= 'z'; ++c)
+            result[static_cast<uint8_t>(c)] = 10 + (c - 'a') * 3;
+        result[' '] = 150;
+        result['\n'] = 5;
+        result[0] = 1;
+        return result;
+    }();
+};
+
+} // anonymous namespace
+
+TEST_SUITE("StaticCodec") {
+
+    TEST_CASE("Tables are computed at compile time") {
+        using Codec = StaticCodec<TextDistribution>;
+        static_assert(Codec::lengths[' '] < Codec::lengths['a'], "frequent symbols get shorter codes");
+        static_assert(Codec::codes[0].length == Codec::TABLE_BITS, "the rarest symbol gets the longest code");
+        static_assert(Codec::table[0] != 0, "the table is filled by the compiler");
+
+        HuffmanTree tree(TextDistribution::counts, CodeAssignment::Canonical);
+        CHECK(Codec::lengths == tree.get_code_lengths());
+        for (size_t symbol = 0; symbol < 256; ++symbol) {
+            CHECK(Codec::codes[symbol].length == tree.get_code_table()[symbol].length);
+            CHECK(Codec::codes[symbol].bits == tree.get_code_table()[symbol].bits);
+        }
+    }
+
+    TEST_CASE("Round trip without a header") {
+        using Codec = StaticCodec<TextDistribution>;
+        std::string data = "the static codec needs no tree at run time\n";
+        data += std::string(1, '\0') + "and no codes in the stream";
+
+        std::stringstream sink;
+        BitWriter writer(sink);
+        Codec::encode(data, writer);
+        writer.finish();
+        std::string bytes = sink.str();
+        bytes.resize(bytes.size() + DECODER_PADDING);
+
+        std::string output(data.size(), ' ');
+        Codec::decode(reinterpret_cast<const uint8_t*>(bytes.data()), bytes.size() - DECODER_PADDING,
+                      reinterpret_cast<uint8_t*>(output.data()), output.size());
+        CHECK(output == data);
+
+        BitWriter unused(sink);
+        CHECK_THROWS_AS(Codec::encode("UPPER", unused), HuffmanException);
+        CHECK_THROWS_AS(Codec::decode(reinterpret_cast<const uint8_t*>(bytes.data()), 1,
+                                      reinterpret_cast<uint8_t*>(output.data()), output.size()), HuffmanException);
+    }
+}
+
+
+TEST_SUITE("HuffmanCodec") {
+
+    template<typename Codec, typename Symbol>
+    void check_round_trip(const Codec& codec, const std::vector<Symbol>& data) {
+        const std::vector<uint8_t> encoded = codec.encode(data.data(), data.size());
+        CHECK(encoded.size() == codec.encoded_size(data.data(), data.size()));
+
+        std::vector<uint8_t> padded = encoded;
+        padded.resize(encoded.size() + Codec::PADDING);
+        std::vector<Symbol> decoded(data.size());
+        codec.decode(padded.data(), encoded.size(), decoded.data(), decoded.size());
+        CHECK(decoded == data);
+    }
+
+    TEST_CASE("Byte codec writes the same bits as BitWriter") {
+        const std::string text = "the byte codec and the archive encoders share one bit order";
+        const std::vector<uint8_t> data(text.begin(), text.end());
+
+        using Codec = HuffmanCodec<uint8_t, 11, uint64_t>;
+        Codec codec(Codec::count(data.data(), data.size()));
+        CodeLengths lengths{};
+        std::copy(codec.code_lengths().begin(), codec.code_lengths().end(), lengths.begin());
+
+        std::stringstream sink;
+        BitWriter writer(sink);
+        SymbolEncoder(make_canonical_codes(lengths)).encode(text, writer);
+        writer.finish();
+        const std::string expected = sink.str();
+        const std::vector<uint8_t> encoded = codec.encode(data.data(), data.size());
+        CHECK(std::string(encoded.begin(), encoded.end()) == expected);
+
+        check_round_trip(codec, data);
+        check_round_trip(HuffmanCodec<uint8_t, 11, uint32_t>(Codec::count(data.data(), data.size())), data);
+    }
+
+    TEST_CASE("Wide symbols") {
+        uint32_t state = 11;
+        auto next = [&state]() {
+            state = state * 1103515245 + 12345;
+            return state >> 8;
+        };
+
+        // 16-bit samples close to a baseline, so small deltas are frequent
+        std::vector<uint16_t> samples(20000);
+        for (uint16_t& sample : samples)
+            sample = static_cast<uint16_t>(30000 + next() % 64 + (next() % 16 == 0 ? next() % 3000 : 0));
+        using SampleCodec = HuffmanCodec<uint16_t, 15, uint32_t>;
+        SampleCodec sample_codec(SampleCodec::count(samples.data(), samples.size()));
+        CHECK(sample_codec.alphabet_size() > 30000);
+        check_round_trip(sample_codec, samples);
+
+        // Sparse token ids with a skewed distribution
+        std::vector<uint32_t> tokens(20000);
+        for (uint32_t& token : tokens)
+            token = next() % 4 == 0 ? next() % 100000 : next() % 50;
+        using TokenCodec = HuffmanCodec<uint32_t, 18>;
+        TokenCodec token_codec(TokenCodec::count(tokens.data(), tokens.size()));
+        check_round_trip(token_codec, tokens);
+        for (uint8_t length : token_codec.code_lengths())
+            CHECK(length <= TokenCodec::MAX_BITS);
+
+        // The lengths alone restore the codes
+        const TokenCodec restored = TokenCodec::from_lengths(token_codec.code_lengths());
+        CHECK(restored.encode(tokens.data(), tokens.size()) == token_codec.encode(tokens.data(), tokens.size()));
+    }
+
+    TEST_CASE("Long codes beyond the primary table") {
+        // Fibonacci counts give a code of every length up to the limit
+        std::vector<uint64_t> counts;
+        uint64_t previous = 1, current = 1;
+        for (size_t symbol = 0; symbol < 24; ++symbol) {
+            counts.push_back(current);
+            const uint64_t next = previous + current;
+            previous = current;
+            current = next;
+        }
+        std::vector<uint16_t> data;
+        for (size_t symbol = 0; symbol < counts.size(); ++symbol)
+            data.insert(data.end(), std::min<uint64_t>(counts[symbol], 300), static_cast<uint16_t>(symbol));
+
+        using Codec = HuffmanCodec<uint16_t, 18, uint64_t, 6>;
+        const Codec codec(counts);
+        CHECK(*std::max_element(codec.code_lengths().begin(), codec.code_lengths().end()) == 18);
+        check_round_trip(codec, data);
+        check_round_trip(HuffmanCodec<uint16_t, 18, uint32_t, 6>(counts), data);
+
+        // The same codes through a full table
+        const auto full = HuffmanCodec<uint16_t, 18>::from_lengths(codec.code_lengths());
+        CHECK(full.encode(data.data(), data.size()) == codec.encode(data.data(), data.size()));
+    }
+
+    TEST_CASE("Codec errors") {
+        using Codec = HuffmanCodec<uint16_t, 4>;
+        const std::vector<uint16_t> data = {1, 2, 2, 3, 3, 3};
+        Codec codec(Codec::count(data.data(), data.size()));
+
+        const std::vector<uint16_t> unknown = {0, 7};
+        CHECK_THROWS_AS(codec.encoded_size(unknown.data(), 1), HuffmanException);
+        CHECK_THROWS_AS(codec.encoded_size(unknown.data() + 1, 1), HuffmanException);
+
+        std::vector<uint8_t> encoded = codec.encode(data.data(), data.size());
+        encoded.resize(encoded.size() + Codec::PADDING);
+        std::vector<uint16_t> decoded(data.size() + 8);
+        CHECK_THROWS_AS(codec.decode(encoded.data(), 1, decoded.data(), decoded.size()), HuffmanException);
+
+        // 17 symbols don't fit 4-bit codes, 5 bits are longer than the codec takes
+        CHECK_THROWS_AS(Codec(std::vector<uint64_t>(17, 1)), HuffmanException);
+        CHECK_THROWS_AS(Codec::from_lengths({1, 5, 5}), HuffmanException);
+        CHECK_THROWS_AS(Codec::from_lengths({1, 1, 1}), HuffmanException);
+        CHECK_THROWS_AS(HuffmanCodec<uint8_t>::from_lengths(std::vector<uint8_t>(257, 9)), HuffmanException);
+    }
+}
+
+
+TEST_SUITE("Tokenizer") {
+
+    std::string expand_all(const Tokenization& tokens, size_t size) {
+        std::string result(size + TOKEN_PADDING, '\0');
+        const size_t written = TokenTable(tokens.words).expand(tokens.ids.data(), tokens.ids.size(),
+                                                               reinterpret_cast<uint8_t*>(result.data()), size);
+        CHECK(written == size);
+        result.resize(written);
+        return result;
+    }
+
+    TEST_CASE("Words and separators") {
+        const std::string text = "GET /api/v1/users 200, GET /api/v1/users 404\n";
+        const Tokenization tokens = tokenize(text);
+
+        // Separator runs are tokens too, single bytes keep their own ids
+        const std::vector<std::string_view> words = {"GET", " /", "api", "v1", "users", "200", ", ", "404"};
+        CHECK(tokens.words == words);
+        const std::vector<uint16_t> ids = {256, 257, 258, '/', 259, '/', 260, ' ', 261, 262,
+                                           256, 257, 258, '/', 259, '/', 260, ' ', 263, '\n'};
+        CHECK(tokens.ids == ids);
+        CHECK(expand_all(tokens, text.size()) == text);
+
+        CHECK(tokenize("").ids.empty());
+        CHECK(tokenize("x").words.empty());
+    }
+
+    TEST_CASE("Long runs and a full dictionary") {
+        std::string text(600, 'a');
+        text += std::string(300, ' ');
+        Tokenization tokens = tokenize(text);
+        CHECK(tokens.ids.size() == 5);
+        CHECK(tokens.words.size() == 4);
+        CHECK(expand_all(tokens, text.size()) == text);
+
+        // More distinct numbers than ids, the last ones go byte by byte
+        text.clear();
+        for (size_t number = 0; number < 70000; ++number)
+            text += std::to_string(number) + " ";
+        tokens = tokenize(text);
+        CHECK(tokens.words.size() == TOKEN_ALPHABET_SIZE - TOKEN_BYTE_IDS);
+        CHECK(expand_all(tokens, text.size()) == text);
+
+        const uint16_t ids[] = {'a', 'b'};
+        std::vector<uint8_t> out(1 + TOKEN_PADDING);
+        CHECK_THROWS_AS(TokenTable({}).expand(ids, 2, out.data(), 1), HuffmanException);
+        const uint16_t unknown[] = {300};
+        CHECK_THROWS_AS(TokenTable({"xy"}).expand(unknown, 1, out.data(), 1), HuffmanException);
+    }
+}
+
+
+TEST_SUITE("CodeCache") {
+
+    TEST_CASE("Cache returns built tables and counts hits") {
+        const CodeTable first = HuffmanTree(std::map<uint8_t, size_t>{{'a', 1}, {'b', 2}, {'c', 4}}).get_code_table();
+        const CodeTable second = HuffmanTree(std::map<uint8_t, size_t>{{'x', 1}, {'y', 1}}).get_code_table();
+        const CodeTable third = HuffmanTree(std::map<uint8_t, size_t>{{'z', 3}, {'a', 1}}).get_code_table();
+
+        CodeCache cache(2);
+        auto encoder = cache.encoder(first, EncoderType::Pair, 100);
+        CHECK(cache.encoder(first, EncoderType::Pair, 100) == encoder);
+        CHECK(cache.encoder(first, EncoderType::Symbol, 100) != encoder);
+        // Auto resolves to the batch encoder for long data
+        CHECK(cache.encoder(first, EncoderType::Auto, 100) == cache.encoder(first, EncoderType::Batch, 100));
+        auto decoder = cache.decoder(first, DecoderType::Table);
+        CHECK(cache.decoder(first, DecoderType::Table) == decoder);
+
+        CodeCacheStats stats = cache.stats();
+        CHECK(stats.hits == 3);
+        CHECK(stats.misses == 4);
+        CHECK(stats.size == 1);
+
+        const std::string data = "abcabcccc";
+        std::stringstream sink;
+        BitWriter writer(sink);
+        encoder->encode(data, writer);
+        writer.finish();
+        std::string bytes = sink.str();
+        bytes.resize(bytes.size() + DECODER_PADDING);
+        std::string output(data.size(), '\0');
+        decoder->decode(reinterpret_cast<const uint8_t*>(bytes.data()), bytes.size() - DECODER_PADDING,
+                        reinterpret_cast<uint8_t*>(output.data()), output.size());
+        CHECK(output == data);
+
+        // The second code set makes the first one the oldest, the third one evicts it
+        cache.decoder(second, DecoderType::Table);
+        cache.decoder(first, DecoderType::Table);
+        cache.decoder(third, DecoderType::Table);
+        CHECK(cache.stats().size == 2);
+        CHECK(cache.decoder(first, DecoderType::Table) == decoder);
+        const uint64_t misses = cache.stats().misses;
+        cache.decoder(second, DecoderType::Table);
+        CHECK(cache.stats().misses == misses + 1);
+
+        cache.clear();
+        stats = cache.stats();
+        CHECK(stats.hits == 0);
+        CHECK(stats.misses == 0);
+        CHECK(stats.size == 0);
+        CHECK_THROWS_AS(CodeCache(0), HuffmanException);
+    }
+}
+
+
 TEST_SUITE("HuffmanArchive Tests") {
 
     void create_test_file(const std::string& path, const std::string& content) {
@@ -210,6 +1181,189 @@ TEST_SUITE("HuffmanArchive Tests") {
             fs::remove(f3);
         }
 
+        SUBCASE("Round-trip in every format and decoder") {
+            std::string f1 = "original.txt";
+            std::string f2 = "compressed.bin";
+            std::string f3 = "decompressed.txt";
+
+            std::string content;
+            for (int i = 0; i < 1000; ++i)
+                content += "line " + std::to_string(i * i) + (i % 7 ? " ok\n" : " failed!\n");
+            create_test_file(f1, content);
+
+            for (ArchiveFormat format : {ArchiveFormat::Legacy, ArchiveFormat::Canonical, ArchiveFormat::Interleaved}) {
+                for (DecoderType decoder : {DecoderType::Auto, DecoderType::Table, DecoderType::Canonical,
+                                            DecoderType::MultiSymbol, DecoderType::TwoLevel,
+                                            DecoderType::Tree, DecoderType::StateMachine,
+                                            DecoderType::Gather}) {
+                    if (format == ArchiveFormat::Legacy && decoder == DecoderType::Canonical)
+                        continue;
+                    CAPTURE(static_cast<int>(format));
+                    CAPTURE(static_cast<int>(decoder));
+
+                    HuffmanArchive compressor(f1, f2, ArchiveOptions{format, decoder});
+                    ArchiveInfo comp_stats = compressor.compress();
+
+                    HuffmanArchive decompressor(f2, f3, ArchiveOptions{format, decoder});
+                    ArchiveInfo decomp_stats = decompressor.decompress();
+
+                    CHECK(decomp_stats.original_size == content.size());
+                    CHECK(decomp_stats.compressed_size == comp_stats.compressed_size);
+                    CHECK(decomp_stats.extra_size == comp_stats.extra_size);
+                    CHECK(files_equal(f1, f3));
+                }
+            }
+
+            fs::remove(f1);
+            fs::remove(f2);
+            fs::remove(f3);
+        }
+
+        SUBCASE("Every encoder writes the same archive") {
+            std::string f1 = "original.txt";
+            std::string f2 = "compressed.bin";
+            std::string f3 = "compressed_pairs.bin";
+
+            create_test_file(f1, "odd length text for the pair encoder: zzzyyx");
+
+            for (ArchiveFormat format : {ArchiveFormat::Legacy, ArchiveFormat::Interleaved}) {
+                ArchiveOptions options{format, DecoderType::Auto};
+                options.encoder = EncoderType::Symbol;
+                HuffmanArchive(f1, f2, options).compress();
+                options.encoder = EncoderType::Pair;
+                HuffmanArchive(f1, f3, options).compress();
+                CHECK(files_equal(f2, f3));
+                options.threads = 4;
+                HuffmanArchive(f1, f3, options).compress();
+                CHECK(files_equal(f2, f3));
+            }
+
+            fs::remove(f1);
+            fs::remove(f2);
+            fs::remove(f3);
+        }
+
+        SUBCASE("Round-trip of interleaved streams") {
+            std::string f1 = "original.txt";
+            std::string f2 = "compressed.bin";
+            std::string f3 = "decompressed.txt";
+
+            for (const std::string content : {"", "ab", "interleaved streams of huffman codes"}) {
+                create_test_file(f1, content);
+
+                for (size_t streams : {1, 3, 4, 5, 8}) {
+                    CAPTURE(content);
+                    CAPTURE(streams);
+                    ArchiveOptions options{ArchiveFormat::Interleaved, DecoderType::Auto, streams};
+
+                    HuffmanArchive compressor(f1, f2, options);
+                    ArchiveInfo comp_stats = compressor.compress();
+                    HuffmanArchive decompressor(f2, f3, options);
+                    ArchiveInfo decomp_stats = decompressor.decompress();
+
+                    CHECK(decomp_stats.compressed_size == comp_stats.compressed_size);
+                    CHECK(decomp_stats.extra_size == comp_stats.extra_size);
+                    CHECK(files_equal(f1, f3));
+                }
+            }
+
+            fs::remove(f1);
+            fs::remove(f2);
+            fs::remove(f3);
+        }
+
+        SUBCASE("Round-trip with length-limited codes") {
+            std::string f1 = "original.txt";
+            std::string f2 = "compressed.bin";
+            std::string f3 = "decompressed.txt";
+
+            // Fibonacci counts of 20 symbols make codes up to 19 bits long
+            std::string content;
+            size_t previous = 1, current = 1;
+            for (char symbol = 'a'; symbol < 'a' + 20; ++symbol) {
+                content += std::string(current, symbol);
+                size_t next = previous + current;
+                previous = current;
+                current = next;
+            }
+            create_test_file(f1, content);
+
+            for (ArchiveFormat format : {ArchiveFormat::Legacy, ArchiveFormat::Canonical, ArchiveFormat::Interleaved}) {
+                CAPTURE(static_cast<int>(format));
+                ArchiveOptions options{format, DecoderType::Auto, INTERLEAVE_WAYS, 8};
+
+                HuffmanArchive unlimited(f1, f2, ArchiveOptions{format, DecoderType::Auto});
+                ArchiveInfo unlimited_stats = unlimited.compress();
+                HuffmanArchive compressor(f1, f2, options);
+                ArchiveInfo comp_stats = compressor.compress();
+                HuffmanArchive decompressor(f2, f3, options);
+                decompressor.decompress();
+
+                CHECK(comp_stats.compressed_size > unlimited_stats.compressed_size);
+                CHECK(files_equal(f1, f3));
+            }
+
+            fs::remove(f1);
+            fs::remove(f2);
+            fs::remove(f3);
+        }
+
+        SUBCASE("Sampled histogram round trip") {
+            std::string f1 = "original.txt";
+            std::string f2 = "compressed.bin";
+            std::string f3 = "decompressed.txt";
+
+            // Mostly text with a few bytes the samples are unlikely to see
+            std::string content;
+            for (size_t i = 0; i < 20000; ++i)
+                content += "the quick brown fox jumps over the lazy dog ";
+            content[123457] = '\x01';
+            content[654321] = '\xFF';
+            create_test_file(f1, content);
+
+            for (SamplingMode mode : {SamplingMode::Strided, SamplingMode::Random}) {
+                for (ArchiveFormat format : {ArchiveFormat::Legacy, ArchiveFormat::Canonical, ArchiveFormat::Interleaved}) {
+                    CAPTURE(static_cast<int>(mode));
+                    CAPTURE(static_cast<int>(format));
+                    ArchiveOptions options{format, DecoderType::Auto};
+                    options.sampling.mode = mode;
+                    options.sampling.block_size = 4096;
+
+                    HuffmanArchive compressor(f1, f2, options);
+                    ArchiveInfo comp_stats = compressor.compress();
+                    HuffmanArchive decompressor(f2, f3, options);
+                    decompressor.decompress();
+
+                    CHECK(comp_stats.compressed_size == fs::file_size(f2) - comp_stats.extra_size);
+                    CHECK(comp_stats.exact_compressed_size > 0);
+                    CHECK(comp_stats.exact_compressed_size <= comp_stats.compressed_size);
+                    CHECK(files_equal(f1, f3));
+                }
+            }
+
+            fs::remove(f1);
+            fs::remove(f2);
+            fs::remove(f3);
+        }
+
+        SUBCASE("Canonical meta is smaller than legacy one") {
+            std::string input = "sample.txt";
+            std::string output = "compressed.bin";
+
+            create_test_file(input, "hello world, hello canonical huffman");
+
+            HuffmanArchive legacy(input, output);
+            HuffmanArchive canonical(input, output, ArchiveOptions{ArchiveFormat::Canonical, DecoderType::Auto});
+            ArchiveInfo legacy_stats = legacy.compress();
+            ArchiveInfo canonical_stats = canonical.compress();
+
+            CHECK(canonical_stats.compressed_size == legacy_stats.compressed_size);
+            CHECK(canonical_stats.extra_size < legacy_stats.extra_size);
+
+            fs::remove(input);
+            fs::remove(output);
+        }
+
         SUBCASE("Throws on corrupted data") {
             std::string input = "corrupted.bin";
             std::string output = "output.txt";
@@ -223,4 +1377,136 @@ TEST_SUITE("HuffmanArchive Tests") {
             fs::remove(output);
         }
     }
+
+    TEST_CASE("16-bit symbols") {
+        std::string f1 = "original.bin";
+        std::string f2 = "compressed.bin";
+        std::string f3 = "decompressed.bin";
+
+        uint32_t state = 3;
+        auto next = [&state]() {
+            state = state * 1103515245 + 12345;
+            return state >> 8;
+        };
+        auto append = [](std::string& data, uint16_t value) {
+            data += static_cast<char>(value & 0xFF);
+            data += static_cast<char>(value >> 8);
+        };
+
+        // A slow wave with noise, like 16-bit PCM
+        std::string pcm;
+        for (size_t i = 0; i < 30000; ++i)
+            append(pcm, static_cast<uint16_t>(1000 + (i / 50) % 200 + next() % 8));
+        // UTF-16 text with Cyrillic letters
+        std::string utf16;
+        for (size_t i = 0; i < 20000; ++i)
+            append(utf16, static_cast<uint16_t>(i % 7 == 0 ? ' ' : 0x0430 + next() % 32));
+        // Every value possible, so lengths go to meta as a plain array
+        std::string dense;
+        for (size_t i = 0; i < 200000; ++i)
+            append(dense, static_cast<uint16_t>(next()));
+        // Skewed enough for codes longer than the primary table
+        std::string skewed;
+        for (size_t i = 0; i < 100000; ++i)
+            append(skewed, static_cast<uint16_t>(next() % 16 == 0 ? next() % 4000 : next() % 4));
+
+        for (const std::string& content : {std::string(), std::string("x"), std::string("xyz"),
+                                           pcm, pcm + "!", utf16, dense, skewed}) {
+            CAPTURE(content.size());
+            create_test_file(f1, content);
+            ArchiveOptions options{ArchiveFormat::Wide16, DecoderType::Auto};
+            HuffmanArchive compressor(f1, f2, options);
+            ArchiveInfo comp_stats = compressor.compress();
+            HuffmanArchive decompressor(f2, f3, options);
+            ArchiveInfo decomp_stats = decompressor.decompress();
+
+            CHECK(files_equal(f1, f3));
+            CHECK(fs::file_size(f3) == content.size());
+            CHECK(comp_stats.original_size == content.size());
+            CHECK(comp_stats.compressed_size + comp_stats.extra_size == fs::file_size(f2));
+            CHECK(decomp_stats.compressed_size == comp_stats.compressed_size);
+            CHECK(decomp_stats.extra_size == comp_stats.extra_size);
+        }
+
+        // Byte codes can't see that the samples are close to each other
+        for (const std::string& content : {pcm, utf16}) {
+            create_test_file(f1, content);
+            HuffmanArchive wide(f1, f2, ArchiveOptions{ArchiveFormat::Wide16, DecoderType::Auto});
+            HuffmanArchive bytes(f1, f2, ArchiveOptions{ArchiveFormat::Canonical, DecoderType::Auto});
+            CHECK(wide.compress().compressed_size < bytes.compress().compressed_size);
+        }
+
+        fs::remove(f1);
+        fs::remove(f2);
+        fs::remove(f3);
+    }
+
+    TEST_CASE("Token archive") {
+        std::string f1 = "original.txt";
+        std::string f2 = "compressed.bin";
+        std::string f3 = "decompressed.txt";
+
+        uint32_t state = 9;
+        auto next = [&state]() {
+            state = state * 1103515245 + 12345;
+            return state >> 8;
+        };
+        const std::vector<std::string> words = {"INFO", "WARN", "request", "completed", "in", "ms", "user_id="};
+        std::string log;
+        for (size_t i = 0; i < 20000; ++i)
+            log += words[next() % words.size()] + (i % 10 == 9 ? "\n" : " ") + std::to_string(next() % 100) + " ";
+
+        std::string binary;
+        for (size_t i = 0; i < 5000; ++i)
+            binary += static_cast<char>(next());
+
+        for (const std::string& content : {std::string(), std::string("x"), std::string("hello, world"), log, binary}) {
+            CAPTURE(content.size());
+            create_test_file(f1, content);
+            ArchiveOptions options{ArchiveFormat::Tokens, DecoderType::Auto};
+            HuffmanArchive compressor(f1, f2, options);
+            ArchiveInfo comp_stats = compressor.compress();
+            HuffmanArchive decompressor(f2, f3, options);
+            ArchiveInfo decomp_stats = decompressor.decompress();
+
+            CHECK(files_equal(f1, f3));
+            CHECK(fs::file_size(f3) == content.size());
+            CHECK(comp_stats.compressed_size + comp_stats.extra_size == fs::file_size(f2));
+            CHECK(decomp_stats.extra_size == comp_stats.extra_size);
+        }
+
+        create_test_file(f1, log);
+        HuffmanArchive tokens(f1, f2, ArchiveOptions{ArchiveFormat::Tokens, DecoderType::Auto});
+        const ArchiveInfo token_stats = tokens.compress();
+        HuffmanArchive bytes(f1, f2, ArchiveOptions{ArchiveFormat::Canonical, DecoderType::Auto});
+        const ArchiveInfo byte_stats = bytes.compress();
+        CHECK(token_stats.compressed_size + token_stats.extra_size < byte_stats.compressed_size + byte_stats.extra_size);
+
+        fs::remove(f1);
+        fs::remove(f2);
+        fs::remove(f3);
+    }
+
+    TEST_CASE("Archives with the same codes share tables") {
+        std::string f1 = "original.txt";
+        std::string f2 = "compressed.bin";
+        std::string f3 = "decompressed.txt";
+        create_test_file(f1, "cached tables for the same statistics");
+
+        CodeCache::global().clear();
+        for (int round = 0; round < 3; ++round) {
+            HuffmanArchive compressor(f1, f2);
+            compressor.compress();
+            HuffmanArchive decompressor(f2, f3);
+            decompressor.decompress();
+            CHECK(files_equal(f1, f3));
+        }
+        const CodeCacheStats stats = CodeCache::global().stats();
+        CHECK(stats.misses == 2);
+        CHECK(stats.hits == 4);
+
+        fs::remove(f1);
+        fs::remove(f2);
+        fs::remove(f3);
+    }
 }